@@ -8,7 +8,10 @@
 #include "Engine/World.h"
 #include "Engine/AssetManager.h"
 #include "GameplayTags.h"
+#include "GameplayTagsManager.h"
 #include "Curves/CurveLinearColor.h"
+#include "Async/Async.h"
+#include "Misc/MemStack.h"
 
 #if WITH_EDITOR
 #include "Misc/DataValidation.h"
@@ -31,6 +34,10 @@ UDestructionComponent::UDestructionComponent(const FObjectInitializer& ObjectIni
 {
 	SetIsReplicatedByDefault(true);
 	NumGlobalInstances = INDEX_NONE;
+
+	// Only ticks while there is submitted damage to apply, or effects, repairs or respawns to advance, see UpdateComponentTickEnabled
+	PrimaryComponentTick.bCanEverTick = true;
+	PrimaryComponentTick.bStartWithTickEnabled = false;
 }
 
 UDestructionComponent::~UDestructionComponent()
@@ -51,8 +58,163 @@ void UDestructionComponent::BeginPlay()
 {
 	Super::BeginPlay();
 
+	RespawnWheel.Init(RespawnWheelSlots, 1.0f / FMath::Max(BatchTickRate, 1.0f));
+	DamageOverTimeEffects.Reserve(ReservedBatchCapacity);
+	ActiveRepairs.Reserve(ReservedBatchCapacity);
+
+	if (bRecordDestructionEvents)
+	{
+		EventLog.Reserve(ReservedEventLogCapacity);
+	}
+
+	EventTimeOrigin = GetWorld() != nullptr ? GetWorld()->GetTimeSeconds() : 0.0;
+
 	GetDestructionDataAssets();
 	InitializeDestructibleInstances();
+
+	// The initial state is the starting point for replaying any event log recorded against this level, also one that is loaded later without recording
+	AddStateSnapshot();
+}
+
+void UDestructionComponent::EndPlay(const EEndPlayReason::Type EndPlayReason)
+{
+	EventLog.StopExport();
+
+	Super::EndPlay(EndPlayReason);
+}
+
+void UDestructionComponent::TickComponent(float DeltaTime, enum ELevelTick TickType, FActorComponentTickFunction* ThisTickFunction)
+{
+	Super::TickComponent(DeltaTime, TickType, ThisTickFunction);
+
+	DrainSubmittedDamage();
+
+	// Effects, repairs and respawns only advance at the configured rate
+	TimeSinceBatchTick += DeltaTime;
+
+	if (TimeSinceBatchTick >= 1.0f / FMath::Max(BatchTickRate, 1.0f))
+	{
+		TickDamageOverTime(TimeSinceBatchTick);
+		TickRepairs(TimeSinceBatchTick);
+		TickRespawns(TimeSinceBatchTick);
+
+		TimeSinceBatchTick = 0.0f;
+	}
+
+	UpdateComponentTickEnabled();
+}
+
+void UDestructionComponent::UpdateComponentTickEnabled()
+{
+	const bool bHasBatchWork = DamageOverTimeEffects.Num() > 0 || ActiveRepairs.Num() > 0 || RespawnWheel.Num() > 0;
+
+	if (!bHasBatchWork)
+	{
+		TimeSinceBatchTick = 0.0f;
+	}
+
+	SetComponentTickEnabled(bHasBatchWork || bSubmittedDamagePending.load());
+}
+
+void UDestructionComponent::SubmitDamage(const FHitResult& HitResult, const float Damage, FGameplayTag DamageType)
+{
+	// Clients would only change their local health, the multicasts run locally there
+	const AActor* Owner = GetOwner();
+
+	if (Owner == nullptr || !Owner->HasAuthority())
+	{
+		return;
+	}
+
+	FDestructionSubmittedDamage Submission;
+	Submission.HitObjectHandle = HitResult.HitObjectHandle;
+	Submission.InstanceIndex = HitResult.Item;
+	Submission.Damage = Damage;
+	Submission.DamageType = DamageType;
+
+	SubmittedDamage.Enqueue(Submission);
+
+	// Only the first submission since the last drain has to wake up the tick on the game thread
+	if (!bSubmittedDamagePending.exchange(true))
+	{
+		AsyncTask(ENamedThreads::GameThread, [WeakThis = TWeakObjectPtr<UDestructionComponent>(this)]()
+		{
+			if (UDestructionComponent* DestructionComponent = WeakThis.Get())
+			{
+				DestructionComponent->UpdateComponentTickEnabled();
+			}
+		});
+	}
+}
+
+void UDestructionComponent::DrainSubmittedDamage()
+{
+	// Clear the flag before draining, so anything submitted from here on wakes the tick up again
+	bSubmittedDamagePending.store(false);
+
+	if (GetOwner() == nullptr || !GetOwner()->HasAuthority())
+	{
+		SubmittedDamage.Empty();
+		return;
+	}
+
+	// The batch only lives for this call, so it goes on the frame's memory stack instead of the heap
+	FMemMark Mark(FMemStack::Get());
+	TArray<FDestructionSubmittedDamage, TMemStackAllocator<>> DrainedDamage;
+
+	FDestructionSubmittedDamage Submission;
+
+	while (SubmittedDamage.Dequeue(Submission))
+	{
+		if (ADestructionActor* DestActor = Cast<ADestructionActor>(Submission.HitObjectHandle.FetchActor()))
+		{
+			Submission.GlobalInstanceIndex = GetGlobalInstanceIndex(DestActor->DestructibleInstanceTag, Submission.InstanceIndex);
+
+			if (Submission.GlobalInstanceIndex != INDEX_NONE)
+			{
+				DrainedDamage.Add(Submission);
+			}
+		}
+	}
+
+	if (DrainedDamage.Num() == 0)
+	{
+		return;
+	}
+
+	// Arrival order depends on thread timing, so order by content instead. Identical submissions are interchangeable
+	DrainedDamage.Sort([](const FDestructionSubmittedDamage& A, const FDestructionSubmittedDamage& B)
+	{
+		if (A.GlobalInstanceIndex != B.GlobalInstanceIndex)
+		{
+			return A.GlobalInstanceIndex < B.GlobalInstanceIndex;
+		}
+
+		if (A.DamageType != B.DamageType)
+		{
+			return A.DamageType < B.DamageType;
+		}
+
+		return A.Damage < B.Damage;
+	});
+
+	// Sum up the resisted damage per instance, so every hit instance only gets updated once per batch
+	for (int32 i = 0; i < DrainedDamage.Num();)
+	{
+		const int32 GlobalInstanceIndex = DrainedDamage[i].GlobalInstanceIndex;
+		const FDestructionDataSet* CurrentDataSet = LevelScript != nullptr ? GetDestructionDataSetPtr(LevelScript->GetDestructibleTag(GlobalInstanceIndex)) : nullptr;
+		float TotalDamage = 0.0f;
+
+		for (; i < DrainedDamage.Num() && DrainedDamage[i].GlobalInstanceIndex == GlobalInstanceIndex; i++)
+		{
+			TotalDamage += CurrentDataSet != nullptr ? GetResistedDamage(*CurrentDataSet, DrainedDamage[i].Damage, DrainedDamage[i].DamageType) : 0.0f;
+		}
+
+		if (TotalDamage > 0.0f)
+		{
+			ApplyDamageToGlobalInstance(GlobalInstanceIndex, TotalDamage);
+		}
+	}
 }
 
 void UDestructionComponent::GetDestructionDataAssets()
@@ -82,14 +244,39 @@ void UDestructionComponent::InitializeDestructibleInstances()
 
 		if (DestructionDataSets.Num() > 0 && LevelScript != nullptr)
 		{
-			TArray<FGameplayTag> DestructibleTags = LevelScript->GetDestuctibleTags();
-			TArray<FTransform> DestructibleTransforms = LevelScript->GetDestructibleTransforms();
+			const TArray<FGameplayTag>& DestructibleTags = LevelScript->GetDestuctibleTags();
+			const TArray<FTransform>& DestructibleTransforms = LevelScript->GetDestructibleTransforms();
+
+			// Every manifest entry gets a global slot. Entries without a data set stay flagged as destroyed
+			NumGlobalInstances = DestructibleTags.Num();
+			DestructiblesHealth.SetNumZeroed(NumGlobalInstances * GetHealthStride());
+			DestroyedInstances.Init(true, NumGlobalInstances);
+			GlobalToLocalIndices.Init(INDEX_NONE, NumGlobalInstances);
+
+			// Size the per-tag index lists from the manifest, so adding the instances doesn't grow them one by one
+			TMap<FGameplayTag, int32> NumInstancesPerTag;
+
+			for (const FGameplayTag& InstanceTag : DestructibleTags)
+			{
+				NumInstancesPerTag.FindOrAdd(InstanceTag)++;
+			}
+
+			DestructiblesIndices.Reserve(NumInstancesPerTag.Num());
+			DestructibleInstanceActors.Reserve(NumInstancesPerTag.Num());
+
+			for (const TPair<FGameplayTag, int32>& TagCount : NumInstancesPerTag)
+			{
+				if (GetDestructionDataSetPtr(TagCount.Key) != nullptr)
+				{
+					DestructiblesIndices.Add(TagCount.Key).Reserve(TagCount.Value);
+				}
+			}
 
 			//for (FGameplayTag Tag : DestructibleTags)
 			for (int32 i = 0; i < DestructibleTags.Num(); i++)
 			{
 				FGameplayTag InstanceTag = DestructibleTags[i];
-				const FTransform CurrentTransform = DestructibleTransforms[i];
+				const FTransform& CurrentTransform = DestructibleTransforms[i];
 				FDestructionDataSet* CurrentDataSet = GetDestructionDataSetPtr(InstanceTag);
 
 				if (CurrentDataSet != nullptr)
@@ -106,10 +293,12 @@ void UDestructionComponent::InitializeDestructibleInstances()
 					if (DestructibleActor.Get() != nullptr)
 					{
 						// Add a new instance to the actor
-						AddNewDestructionInstance(InstanceTag, CurrentDataSet, DestructibleActor, CurrentTransform);
+						AddNewDestructionInstance(InstanceTag, i, CurrentDataSet, DestructibleActor, CurrentTransform);
 					}
 				}
 			}
+
+			LogInstanceStateMemory();
 		}
 	}
 }
@@ -125,86 +314,167 @@ TObjectPtr<ADestructionActor> UDestructionComponent::SpawnNewDestructionActor(FG
 	return DestructibleActor;
 }
 
-void UDestructionComponent::AddNewDestructionInstance(FGameplayTag InstanceTag, FDestructionDataSet* CurrentDataSet, TObjectPtr<ADestructionActor> DestructibleActor, FTransform CurrentTransform)
+void UDestructionComponent::AddNewDestructionInstance(FGameplayTag InstanceTag, int32 GlobalInstanceIndex, FDestructionDataSet* CurrentDataSet, TObjectPtr<ADestructionActor> DestructibleActor, const FTransform& CurrentTransform)
 {
-	// Increment the instance count and reference it
-	NumGlobalInstances++;
-
 	// Add a new instance to the actor
 	const int32 CurrentInstanceIndex = DestructibleActor->GetISMComp().Get()->AddInstance(CurrentTransform, true);
 
-	TMap<int32, int32>* LocalInstanceMap = DestructiblesIndices.Find(InstanceTag);
-	
-	if(LocalInstanceMap == nullptr)
-	{
-		TMap<int32, int32> NewLocalInstanceMap;
-		NewLocalInstanceMap.Add(CurrentInstanceIndex, NumGlobalInstances);
-		DestructiblesIndices.Add(InstanceTag, NewLocalInstanceMap);
-	}
-	else
-	{
-		LocalInstanceMap->Add(CurrentInstanceIndex, NumGlobalInstances);
-	}
-	
-	DestructiblesHealth.Add(NumGlobalInstances, CurrentDataSet->Health);
-	DestructibleInstanceTransforms.Add(NumGlobalInstances, CurrentTransform);
+	// ISM instances are only ever appended, so the next slot in the list is always the new instance index
+	TArray<int32>& LocalInstanceMap = DestructiblesIndices.FindOrAdd(InstanceTag);
+	LocalInstanceMap.Add(GlobalInstanceIndex);
+	GlobalToLocalIndices[GlobalInstanceIndex] = CurrentInstanceIndex;
+
+	DestroyedInstances[GlobalInstanceIndex] = false;
+	WriteInstanceHealth(GlobalInstanceIndex, CurrentDataSet->Health, CurrentDataSet->Health);
 
 	UpdateInstance(InstanceTag, CurrentInstanceIndex, CurrentDataSet->Health);
 }
 
 int32 UDestructionComponent::GetGlobalInstanceIndex(FGameplayTag InstanceTag, int32 InstanceIndex) const
 {
-	TMap<int32, int32> LocalInstanceMap = DestructiblesIndices.Find(InstanceTag) != nullptr ? *DestructiblesIndices.Find(InstanceTag) : TMap<int32, int32>();
+	const TArray<int32>* LocalInstanceMap = DestructiblesIndices.Find(InstanceTag);
 
-	if (LocalInstanceMap.Find(InstanceIndex))
+	if (LocalInstanceMap != nullptr && LocalInstanceMap->IsValidIndex(InstanceIndex))
 	{
-		return *LocalInstanceMap.Find(InstanceIndex);
+		return (*LocalInstanceMap)[InstanceIndex];
 	}
 
 	return INDEX_NONE;
 }
 
-FDestructionDataSet UDestructionComponent::GetDestructionDataSet(FGameplayTag DestructionTag)
+int32 UDestructionComponent::GetHealthStride() const
+{
+	switch (HealthPrecision)
+	{
+	case EDestructionHealthPrecision::Quantized8:
+		return sizeof(uint8);
+	case EDestructionHealthPrecision::Quantized16:
+		return sizeof(uint16);
+	default:
+		return sizeof(float);
+	}
+}
+
+float UDestructionComponent::ReadInstanceHealth(int32 GlobalInstanceIndex, float MaxHealth) const
+{
+	return ReadInstanceHealth(DestructiblesHealth, GlobalInstanceIndex, MaxHealth);
+}
+
+float UDestructionComponent::WriteInstanceHealth(int32 GlobalInstanceIndex, float NewHealth, float MaxHealth)
 {
-	TArray<FGameplayTag> Keys;
+	return WriteInstanceHealth(DestructiblesHealth, GlobalInstanceIndex, NewHealth, MaxHealth);
+}
 
-	DestructionDataSets.GenerateKeyArray(Keys);
+float UDestructionComponent::ReadInstanceHealth(const TArray<uint8>& Health, int32 GlobalInstanceIndex, float MaxHealth) const
+{
+	const uint8* HealthData = Health.GetData() + GlobalInstanceIndex * GetHealthStride();
 
-	for (FGameplayTag Key : Keys)
+	switch (HealthPrecision)
 	{
-		if (Key.MatchesTagExact(DestructionTag))
-		{
-			if (DestructionDataSets.Find(Key) != nullptr)
-			{
-				return *DestructionDataSets.Find(Key);
-			}
-		}
+	case EDestructionHealthPrecision::Quantized8:
+		return (*HealthData / float(MAX_uint8)) * MaxHealth;
+	case EDestructionHealthPrecision::Quantized16:
+	{
+		uint16 QuantizedHealth;
+		FMemory::Memcpy(&QuantizedHealth, HealthData, sizeof(uint16));
+		return (QuantizedHealth / float(MAX_uint16)) * MaxHealth;
+	}
+	default:
+	{
+		float Health;
+		FMemory::Memcpy(&Health, HealthData, sizeof(float));
+		return Health;
+	}
+	}
+}
+
+float UDestructionComponent::WriteInstanceHealth(TArray<uint8>& Health, int32 GlobalInstanceIndex, float NewHealth, float MaxHealth) const
+{
+	uint8* HealthData = Health.GetData() + GlobalInstanceIndex * GetHealthStride();
+
+	if (HealthPrecision == EDestructionHealthPrecision::Full)
+	{
+		FMemory::Memcpy(HealthData, &NewHealth, sizeof(float));
+		return NewHealth;
+	}
+
+	const int32 MaxQuantized = HealthPrecision == EDestructionHealthPrecision::Quantized8 ? MAX_uint8 : MAX_uint16;
+	const int32 CurrentQuantized = FMath::RoundToInt(ReadInstanceHealth(Health, GlobalInstanceIndex, 1.0f) * MaxQuantized);
+	const float CurrentHealth = ReadInstanceHealth(Health, GlobalInstanceIndex, MaxHealth);
+	const float ScaledHealth = (MaxHealth > 0.0f ? FMath::Clamp(NewHealth / MaxHealth, 0.0f, 1.0f) : 0.0f) * MaxQuantized;
+	int32 QuantizedHealth = FMath::RoundToInt(ScaledHealth);
+
+	// Round to the nearest step, so quantizing doesn't bias hits or repairs. Only a change that nearest rounding would swallow
+	// is forced to move one step, so small hits and repairs aren't lost. A small last hit can therefore take a living instance down to 0,
+	// callers check the returned health for that
+	if (NewHealth <= 0.0f)
+	{
+		QuantizedHealth = 0;
+	}
+	else if (NewHealth < CurrentHealth && QuantizedHealth >= CurrentQuantized)
+	{
+		QuantizedHealth = CurrentQuantized - 1;
+	}
+	else if (NewHealth > CurrentHealth && QuantizedHealth <= CurrentQuantized)
+	{
+		QuantizedHealth = FMath::Min(CurrentQuantized + 1, MaxQuantized);
+	}
+
+	if (HealthPrecision == EDestructionHealthPrecision::Quantized8)
+	{
+		*HealthData = (uint8)QuantizedHealth;
+	}
+	else
+	{
+		const uint16 QuantizedHealth16 = (uint16)QuantizedHealth;
+		FMemory::Memcpy(HealthData, &QuantizedHealth16, sizeof(uint16));
 	}
 
-	return FDestructionDataSet();
+	return ReadInstanceHealth(Health, GlobalInstanceIndex, MaxHealth);
 }
 
-FDestructionDataSet* UDestructionComponent::GetDestructionDataSetPtr(FGameplayTag DestructionTag)
+void UDestructionComponent::GetInstanceStateMemory(SIZE_T& OutCompactBytes, SIZE_T& OutLegacyBytes) const
 {
-	TArray<FGameplayTag> Keys;
+	OutCompactBytes = DestructiblesHealth.GetAllocatedSize() + DestroyedInstances.GetAllocatedSize() + GlobalToLocalIndices.GetAllocatedSize() + DestructiblesIndices.GetAllocatedSize();
 
-	DestructionDataSets.GenerateKeyArray(Keys);
+	for (const TPair<FGameplayTag, TArray<int32>>& LocalInstanceMap : DestructiblesIndices)
+	{
+		OutCompactBytes += LocalInstanceMap.Value.GetAllocatedSize();
+	}
+
+	// The previous layout kept a health, a transform and an index map entry per instance, each with its own hash slot
+	const SIZE_T LegacyBytesPerInstance = sizeof(TSetElement<TPair<int32, float>>) + sizeof(TSetElement<TPair<int32, FTransform>>) + sizeof(TSetElement<TPair<int32, int32>>) + 3 * sizeof(FSetElementId);
+	OutLegacyBytes = LegacyBytesPerInstance * FMath::Max(NumGlobalInstances, 0);
+}
 
-	for (FGameplayTag Key : Keys)
+void UDestructionComponent::LogInstanceStateMemory() const
+{
+	if (NumGlobalInstances <= 0)
 	{
-		if (Key.MatchesTagExact(DestructionTag))
-		{
-			if (DestructionDataSets.Find(Key) != nullptr)
-			{
-				return DestructionDataSets.Find(Key);
-			}
-		}
+		return;
 	}
 
-	return nullptr;
+	SIZE_T CompactBytes, LegacyBytes;
+	GetInstanceStateMemory(CompactBytes, LegacyBytes);
+
+	UE_LOG(LogDestruction, Log, TEXT("Destruction instance state: %d instances, %.1f bytes/instance (map based layout: %.1f bytes/instance). The ISM's own render data is not included."),
+		NumGlobalInstances, double(CompactBytes) / NumGlobalInstances, double(LegacyBytes) / NumGlobalInstances);
+}
+
+FDestructionDataSet UDestructionComponent::GetDestructionDataSet(FGameplayTag DestructionTag)
+{
+	const FDestructionDataSet* DataSet = GetDestructionDataSetPtr(DestructionTag);
+
+	return DataSet != nullptr ? *DataSet : FDestructionDataSet();
+}
+
+FDestructionDataSet* UDestructionComponent::GetDestructionDataSetPtr(FGameplayTag DestructionTag)
+{
+	// Gameplay tag keys hash and compare exactly, so a lookup matches the same keys as MatchesTagExact without copying them out
+	return DestructionDataSets.Find(DestructionTag);
 }
 
-void UDestructionComponent::ApplyDamageToHitResult(FHitResult HitResult, const float Damage)
+void UDestructionComponent::ApplyDamageToHitResult(const FHitResult& HitResult, const float Damage)
 {
 	if(HitResult.GetActor())
 	{
@@ -215,132 +485,951 @@ void UDestructionComponent::ApplyDamageToHitResult(FHitResult HitResult, const f
 	}
 }
 
-void UDestructionComponent::ApplyDamageToInstance(FGameplayTag InstanceTag, int32 InstanceIndex, float Damage)
+void UDestructionComponent::ApplyTypedDamageToHitResult(const FHitResult& HitResult, const float Damage, FGameplayTag DamageType)
 {
-	const int32 GlobalInstanceIndex = GetGlobalInstanceIndex(InstanceTag, InstanceIndex);
+	if (ADestructionActor* DestActor = Cast<ADestructionActor>(HitResult.GetActor()))
+	{
+		if (const FDestructionDataSet* CurrentDataSet = GetDestructionDataSetPtr(DestActor->DestructibleInstanceTag))
+		{
+			ApplyDamageToInstance(DestActor->DestructibleInstanceTag, HitResult.Item, GetResistedDamage(*CurrentDataSet, Damage, DamageType));
+		}
+	}
+}
+
+void UDestructionComponent::ApplyDamageOverTimeToHitResult(const FHitResult& HitResult, const float DamagePerSecond, const float Duration, FGameplayTag DamageType)
+{
+	ADestructionActor* DestActor = Cast<ADestructionActor>(HitResult.GetActor());
 
-	if (GlobalInstanceIndex != INDEX_NONE)
+	if (DestActor == nullptr || Duration <= 0.0f)
 	{
-		const float CurrentHealth = DestructiblesHealth.Find(GlobalInstanceIndex) != nullptr ? *DestructiblesHealth.Find(GlobalInstanceIndex) : -1;
+		return;
+	}
 
-		// Decrease health for the hit instance
-		if (CurrentHealth >= 0.0f)
-		{
-			const float NewHealth = CurrentHealth - Damage;
+	const int32 GlobalInstanceIndex = GetGlobalInstanceIndex(DestActor->DestructibleInstanceTag, HitResult.Item);
+	const FDestructionDataSet* CurrentDataSet = GetDestructionDataSetPtr(DestActor->DestructibleInstanceTag);
 
-			// Subtract health without destroying the whole instance
-			if (NewHealth > 0)
-			{
-				DestructiblesHealth.Add(GlobalInstanceIndex, NewHealth);
+	if (GlobalInstanceIndex != INDEX_NONE && CurrentDataSet != nullptr && !DestroyedInstances[GlobalInstanceIndex])
+	{
+		const float ResistedDamagePerSecond = GetResistedDamage(*CurrentDataSet, DamagePerSecond, DamageType);
+		const int32 EffectIndex = DamageOverTimeEffects.Find(GlobalInstanceIndex, DamageType);
 
-				// Update the instance mesh to represent the new damage state
-				// Pass the new health as param along, as the DestructilesHealth list replication happens *after* this update call
-				UpdateInstance(InstanceTag, InstanceIndex, NewHealth);
-				
-			}
-			// The instance hit 0 health and needs cleaning up
-			else
-			{
-				/**
-					Calling this directly is fine in a simple use case such as this test.
-					However, in more complex scenarios, where we employ AOE weapons that destroy more than one piece at a time
-					destroying instances direclty will cause the destructible lists to change indexes
-					during the cleanup operation and subsequently delete the wrong instances.
-					This can be prevented by queueing the destroyed indixes in an (async) queue and running the cleanup at the end of each frame
-				*/
-				DestroyInstance(InstanceTag, InstanceIndex, GlobalInstanceIndex);
-			}
+		if (EffectIndex != INDEX_NONE)
+		{
+			// Refresh the running effect, keeping whatever damage it has already accumulated
+			DamageOverTimeEffects.DamagePerSecond[EffectIndex] = ResistedDamagePerSecond;
+			DamageOverTimeEffects.RemainingTime[EffectIndex] = Duration;
+		}
+		else
+		{
+			DamageOverTimeEffects.Add(GlobalInstanceIndex, DamageType, ResistedDamagePerSecond, Duration, GetMinHealthUpdate(*CurrentDataSet));
 		}
+
+		UpdateComponentTickEnabled();
 	}
 }
 
-void UDestructionComponent::UpdateInstance_Implementation(FGameplayTag InstanceTag, int32 InstanceIndex, float NewHealth)
+void UDestructionComponent::RepairHitResult(const FHitResult& HitResult, const float Amount)
 {
-	FDestructionDataSet* CurrentDestructionDataSet = GetDestructionDataSetPtr(InstanceTag);
-	TObjectPtr<ADestructionActor> DestructibleActor = *DestructibleInstanceActors.Find(InstanceTag);
-
-	if (DestructibleActor && CurrentDestructionDataSet)
+	if (ADestructionActor* DestActor = Cast<ADestructionActor>(HitResult.GetActor()))
 	{
-		const float HealthNormalized = NewHealth / CurrentDestructionDataSet->Health;
-
-		// Grab the color value that corresponds to our normalized health value
-		const FLinearColor CurrentColor = CurrentDestructionDataSet->HealthStateColorCurve->GetLinearColorValue(HealthNormalized);
+		const int32 GlobalInstanceIndex = GetGlobalInstanceIndex(DestActor->DestructibleInstanceTag, HitResult.Item);
 
-		// Let's update the color value based on the health curve value. This can probably be handled with the SetCustomDataValueFloat3 instead
-		DestructibleActor->GetISMComp()->SetCustomDataValue(InstanceIndex, 0, CurrentColor.R, true);
-		DestructibleActor->GetISMComp()->SetCustomDataValue(InstanceIndex, 1, CurrentColor.G, true);
-		DestructibleActor->GetISMComp()->SetCustomDataValue(InstanceIndex, 2, CurrentColor.B, true);
+		if (GlobalInstanceIndex != INDEX_NONE && Amount > 0.0f)
+		{
+			RepairGlobalInstance(GlobalInstanceIndex, Amount);
+		}
 	}
 }
 
-void UDestructionComponent::DestroyInstance_Implementation(FGameplayTag InstanceTag, int32 InstanceIndex, int32 GlobalInstanceIndex)
+void UDestructionComponent::StartRepairingHitResult(const FHitResult& HitResult, const float HealthPerSecond)
 {
-	TObjectPtr<ADestructionActor> DestructibleActor = DestructibleInstanceActors.Find(InstanceTag) != nullptr ? *DestructibleInstanceActors.Find(InstanceTag) : nullptr;
+	ADestructionActor* DestActor = Cast<ADestructionActor>(HitResult.GetActor());
 
-	if (DestructibleActor != nullptr)
+	if (DestActor == nullptr || HealthPerSecond <= 0.0f)
 	{
-		DestructibleActor.Get()->GetISMComp()->RemoveInstance(InstanceIndex);
-		
-		TMap<int32, int32>* LocalInstanceMap = DestructiblesIndices.Find(InstanceTag);
-		
-		if(LocalInstanceMap != nullptr)
-		{
-			LocalInstanceMap->Remove(InstanceIndex);
+		return;
+	}
 
-			// Rebuild the indices
-			TArray<int32> Indices;
-			LocalInstanceMap->GenerateValueArray(Indices);
-			LocalInstanceMap->Empty();
+	const int32 GlobalInstanceIndex = GetGlobalInstanceIndex(DestActor->DestructibleInstanceTag, HitResult.Item);
+	const FDestructionDataSet* CurrentDataSet = GetDestructionDataSetPtr(DestActor->DestructibleInstanceTag);
 
-			for (int i = 0; i < Indices.Num(); i++)
-			{
-				LocalInstanceMap->Add(i, Indices[i]);
-			}
+	if (GlobalInstanceIndex != INDEX_NONE && CurrentDataSet != nullptr && !DestroyedInstances[GlobalInstanceIndex])
+	{
+		const int32 RepairIndex = ActiveRepairs.Find(GlobalInstanceIndex);
+
+		if (RepairIndex != INDEX_NONE)
+		{
+			ActiveRepairs.HealthPerSecond[RepairIndex] = HealthPerSecond;
+		}
+		else
+		{
+			ActiveRepairs.Add(GlobalInstanceIndex, HealthPerSecond, GetMinHealthUpdate(*CurrentDataSet));
 		}
 
-		DestructiblesHealth.Remove(GlobalInstanceIndex);
-		DestructibleInstanceTransforms.Remove(GlobalInstanceIndex);
+		UpdateComponentTickEnabled();
 	}
 }
 
-float UDestructionComponent::GetDestructibleHealthForIndex(FGameplayTag InstanceTag, int32 InstanceIndex) const
+void UDestructionComponent::StopRepairingHitResult(const FHitResult& HitResult)
 {
-	float ReturnValue = INDEX_NONE;
-	const int32 GlobalInstanceIndex = GetGlobalInstanceIndex(InstanceTag, InstanceIndex);
-	// Decrease health for the hit instance
-	if (GlobalInstanceIndex != INDEX_NONE && DestructiblesHealth.Find(GlobalInstanceIndex) != nullptr)
+	if (ADestructionActor* DestActor = Cast<ADestructionActor>(HitResult.GetActor()))
 	{
-		const float CurrentHealthData = *DestructiblesHealth.Find(GlobalInstanceIndex);
-		ReturnValue = CurrentHealthData;
-	}
-
-	return ReturnValue;
-};
+		const int32 RepairIndex = ActiveRepairs.Find(GetGlobalInstanceIndex(DestActor->DestructibleInstanceTag, HitResult.Item));
 
-void UDestructionComponent::GetInstanceTransform(FGameplayTag InstanceTag, int32 InstanceIndex, FTransform& InstanceTransform)
-{
-	const int32 GlobalInstanceIndex = GetGlobalInstanceIndex(InstanceTag, InstanceIndex);
-	InstanceTransform = DestructibleInstanceTransforms.Find(GlobalInstanceIndex) ? *DestructibleInstanceTransforms.Find(GlobalInstanceIndex) : FTransform();
+		if (RepairIndex != INDEX_NONE)
+		{
+			ActiveRepairs.RemoveAtSwap(RepairIndex);
+		}
+	}
 }
 
-//----------------------------------------------------------------------//
-// debug
-//----------------------------------------------------------------------//
-#if WITH_GAMEPLAY_DEBUGGER_MENU
-void UDestructionComponent::DescribeSelfToGameplayDebugger(FGameplayDebuggerCategory* DebuggerCategory)
+bool UDestructionComponent::RepairGlobalInstance(int32 GlobalInstanceIndex, float Amount)
 {
-	if (DebuggerCategory == nullptr)
+	if (LevelScript == nullptr || !GlobalToLocalIndices.IsValidIndex(GlobalInstanceIndex) || GlobalToLocalIndices[GlobalInstanceIndex] == INDEX_NONE || DestroyedInstances[GlobalInstanceIndex])
 	{
-		return;
+		return false;
 	}
 
-	if (DebuggerCategory)
+	const FGameplayTag& InstanceTag = LevelScript->GetDestructibleTag(GlobalInstanceIndex);
+	const FDestructionDataSet* CurrentDataSet = GetDestructionDataSetPtr(InstanceTag);
+
+	if (CurrentDataSet == nullptr)
 	{
-		UWorld* World = GetWorld();
+		return false;
+	}
 
-		if (World)
+	const float CurrentHealth = ReadInstanceHealth(GlobalInstanceIndex, CurrentDataSet->Health);
+	float NewHealth = FMath::Min(CurrentHealth + Amount, CurrentDataSet->Health);
+
+	if (NewHealth > CurrentHealth)
+	{
+		// Record before writing, a snapshot taken by the recording must not contain this repair yet.
+		// The requested amount is recorded, so replaying runs the exact same clamped sum
+		RecordEvent(EDestructionEventType::Repair, GlobalInstanceIndex, Amount);
+		NewHealth = WriteInstanceHealth(GlobalInstanceIndex, NewHealth, CurrentDataSet->Health);
+		UpdateInstance(InstanceTag, GlobalToLocalIndices[GlobalInstanceIndex], NewHealth);
+	}
+
+	return NewHealth >= CurrentDataSet->Health;
+}
+
+float UDestructionComponent::GetResistedDamage(const FDestructionDataSet& DataSet, float Damage, FGameplayTag DamageType) const
+{
+	// Walk up the tag hierarchy, so Damage.Fire.Napalm uses the Damage.Fire resistance unless it has its own
+	for (FGameplayTag CurrentType = DamageType; CurrentType.IsValid(); CurrentType = CurrentType.RequestDirectParent())
+	{
+		if (const float* Resistance = DataSet.DamageTypeResistances.Find(CurrentType))
 		{
-			
+			return Damage * (1.0f - FMath::Min(*Resistance, 1.0f));
+		}
+	}
+
+	return Damage;
+}
+
+float UDestructionComponent::GetHealthQuantum(const FDestructionDataSet& DataSet) const
+{
+	switch (HealthPrecision)
+	{
+	case EDestructionHealthPrecision::Quantized8:
+		return DataSet.Health / MAX_uint8;
+	case EDestructionHealthPrecision::Quantized16:
+		return DataSet.Health / MAX_uint16;
+	default:
+		return 0.0f;
+	}
+}
+
+float UDestructionComponent::GetMinHealthUpdate(const FDestructionDataSet& DataSet) const
+{
+	// Never below one quantized step, smaller amounts would be rounded up to a full one every batch tick
+	return FMath::Max(GetHealthQuantum(DataSet), DataSet.Health * MinHealthUpdateFraction);
+}
+
+void UDestructionComponent::TickDamageOverTime(float DeltaTime)
+{
+	const int32 NumEffects = DamageOverTimeEffects.Num();
+	const float* DamagePerSecond = DamageOverTimeEffects.DamagePerSecond.GetData();
+	float* RemainingTime = DamageOverTimeEffects.RemainingTime.GetData();
+	float* PendingDamage = DamageOverTimeEffects.PendingDamage.GetData();
+
+	// Advance every effect in one branch free pass over the dense arrays
+	for (int32 i = 0; i < NumEffects; i++)
+	{
+		const float StepTime = FMath::Min(DeltaTime, RemainingTime[i]);
+		PendingDamage[i] += DamagePerSecond[i] * StepTime;
+		RemainingTime[i] -= StepTime;
+	}
+
+	// Apply the accumulated damage and retire finished effects. Iterate backwards so RemoveAtSwap only moves already visited effects
+	for (int32 i = NumEffects - 1; i >= 0; i--)
+	{
+		const int32 GlobalInstanceIndex = DamageOverTimeEffects.GlobalInstanceIndices[i];
+		const bool bExpired = DamageOverTimeEffects.RemainingTime[i] <= 0.0f;
+
+		if (!DestroyedInstances[GlobalInstanceIndex] && (bExpired || DamageOverTimeEffects.PendingDamage[i] >= DamageOverTimeEffects.ApplyThreshold[i]))
+		{
+			ApplyDamageToGlobalInstance(GlobalInstanceIndex, DamageOverTimeEffects.PendingDamage[i]);
+			DamageOverTimeEffects.PendingDamage[i] = 0.0f;
+		}
+
+		if (bExpired || DestroyedInstances[GlobalInstanceIndex])
+		{
+			DamageOverTimeEffects.RemoveAtSwap(i);
+		}
+	}
+}
+
+void UDestructionComponent::TickRepairs(float DeltaTime)
+{
+	const int32 NumRepairs = ActiveRepairs.Num();
+	const float* HealthPerSecond = ActiveRepairs.HealthPerSecond.GetData();
+	float* PendingHealth = ActiveRepairs.PendingHealth.GetData();
+
+	for (int32 i = 0; i < NumRepairs; i++)
+	{
+		PendingHealth[i] += HealthPerSecond[i] * DeltaTime;
+	}
+
+	// Finished repairs are swapped out the same way as expired damage over time effects
+	for (int32 i = NumRepairs - 1; i >= 0; i--)
+	{
+		const int32 GlobalInstanceIndex = ActiveRepairs.GlobalInstanceIndices[i];
+		bool bFinished = DestroyedInstances[GlobalInstanceIndex];
+
+		if (!bFinished && ActiveRepairs.PendingHealth[i] >= ActiveRepairs.ApplyThreshold[i])
+		{
+			bFinished = RepairGlobalInstance(GlobalInstanceIndex, ActiveRepairs.PendingHealth[i]);
+			ActiveRepairs.PendingHealth[i] = 0.0f;
+		}
+
+		if (bFinished)
+		{
+			ActiveRepairs.RemoveAtSwap(i);
+		}
+	}
+}
+
+void UDestructionComponent::TickRespawns(float DeltaTime)
+{
+	if (RespawnWheel.Num() == 0 || LevelScript == nullptr)
+	{
+		return;
+	}
+
+	FMemMark Mark(FMemStack::Get());
+	TArray<int32, TMemStackAllocator<>> DueRespawns;
+	RespawnWheel.Advance(DeltaTime, DueRespawns);
+
+	for (const int32 GlobalInstanceIndex : DueRespawns)
+	{
+		RecordEvent(EDestructionEventType::Respawn, GlobalInstanceIndex, 0.0f);
+		RespawnInstance(LevelScript->GetDestructibleTag(GlobalInstanceIndex), GlobalToLocalIndices[GlobalInstanceIndex], GlobalInstanceIndex);
+	}
+}
+
+void UDestructionComponent::ApplyDamageToGlobalInstance(int32 GlobalInstanceIndex, float Damage)
+{
+	if (LevelScript != nullptr && GlobalToLocalIndices.IsValidIndex(GlobalInstanceIndex) && GlobalToLocalIndices[GlobalInstanceIndex] != INDEX_NONE)
+	{
+		ApplyDamageToInstance(LevelScript->GetDestructibleTag(GlobalInstanceIndex), GlobalToLocalIndices[GlobalInstanceIndex], Damage);
+	}
+}
+
+void UDestructionComponent::ApplyDamageToInstance(FGameplayTag InstanceTag, int32 InstanceIndex, float Damage)
+{
+	const int32 GlobalInstanceIndex = GetGlobalInstanceIndex(InstanceTag, InstanceIndex);
+	const FDestructionDataSet* CurrentDataSet = GetDestructionDataSetPtr(InstanceTag);
+
+	if (GlobalInstanceIndex != INDEX_NONE && CurrentDataSet != nullptr)
+	{
+		// Decrease health for the hit instance
+		if (!DestroyedInstances[GlobalInstanceIndex])
+		{
+			float NewHealth = ReadInstanceHealth(GlobalInstanceIndex, CurrentDataSet->Health) - Damage;
+
+			if (NewHealth > 0)
+			{
+				// Record before writing, a snapshot taken by the recording must not contain this damage yet
+				RecordEvent(EDestructionEventType::Damage, GlobalInstanceIndex, Damage);
+				NewHealth = WriteInstanceHealth(GlobalInstanceIndex, NewHealth, CurrentDataSet->Health);
+			}
+
+			// Subtract health without destroying the whole instance
+			if (NewHealth > 0)
+			{
+				// Update the instance mesh to represent the new damage state
+				// Pass the new health as param along, as the DestructilesHealth list replication happens *after* this update call
+				UpdateInstance(InstanceTag, InstanceIndex, NewHealth);
+				
+			}
+			// The instance hit 0 health, or quantized health rounded a last small hit down to 0, and needs cleaning up
+			else
+			{
+				/**
+					Destroyed instances keep their ISM slot and are only hidden, so destroying directly
+					does not shift the indices of any other instance, even when AOE weapons destroy several pieces at once.
+				*/
+				RecordEvent(EDestructionEventType::Destroy, GlobalInstanceIndex, Damage);
+				DestroyInstance(InstanceTag, InstanceIndex, GlobalInstanceIndex);
+
+				if (CurrentDataSet->RespawnTime > 0.0f)
+				{
+					RespawnWheel.Schedule(GlobalInstanceIndex, CurrentDataSet->RespawnTime);
+					UpdateComponentTickEnabled();
+				}
+			}
+		}
+	}
+}
+
+void UDestructionComponent::UpdateInstance_Implementation(FGameplayTag InstanceTag, int32 InstanceIndex, float NewHealth)
+{
+	FDestructionDataSet* CurrentDestructionDataSet = GetDestructionDataSetPtr(InstanceTag);
+	TObjectPtr<ADestructionActor> DestructibleActor = *DestructibleInstanceActors.Find(InstanceTag);
+
+	if (DestructibleActor && CurrentDestructionDataSet)
+	{
+		const float HealthNormalized = NewHealth / CurrentDestructionDataSet->Health;
+
+		// Grab the color value that corresponds to our normalized health value
+		const FLinearColor CurrentColor = CurrentDestructionDataSet->HealthStateColorCurve->GetLinearColorValue(HealthNormalized);
+
+		// Let's update the color value based on the health curve value. This can probably be handled with the SetCustomDataValueFloat3 instead
+		DestructibleActor->GetISMComp()->SetCustomDataValue(InstanceIndex, 0, CurrentColor.R, true);
+		DestructibleActor->GetISMComp()->SetCustomDataValue(InstanceIndex, 1, CurrentColor.G, true);
+		DestructibleActor->GetISMComp()->SetCustomDataValue(InstanceIndex, 2, CurrentColor.B, true);
+	}
+}
+
+void UDestructionComponent::DestroyInstance_Implementation(FGameplayTag InstanceTag, int32 InstanceIndex, int32 GlobalInstanceIndex)
+{
+	SetInstanceHidden(InstanceTag, InstanceIndex, GlobalInstanceIndex, true);
+
+	if (DestroyedInstances.IsValidIndex(GlobalInstanceIndex))
+	{
+		DestroyedInstances[GlobalInstanceIndex] = true;
+		WriteInstanceHealth(GlobalInstanceIndex, 0.0f, 0.0f);
+	}
+}
+
+void UDestructionComponent::SetInstanceHidden(FGameplayTag InstanceTag, int32 InstanceIndex, int32 GlobalInstanceIndex, bool bHidden)
+{
+	TObjectPtr<ADestructionActor> DestructibleActor = DestructibleInstanceActors.Find(InstanceTag) != nullptr ? *DestructibleInstanceActors.Find(InstanceTag) : nullptr;
+
+	if (DestructibleActor == nullptr)
+	{
+		return;
+	}
+
+	UInstancedStaticMeshComponent* ISMComp = DestructibleActor.Get()->GetISMComp().Get();
+	FTransform InstanceTransform;
+
+	if (bHidden)
+	{
+		// Hide the instance instead of removing it, so the ISM indices of all other instances stay stable.
+		// Zero scaled instances are neither rendered nor get a physics body
+		if (ISMComp->GetInstanceTransform(InstanceIndex, InstanceTransform, true))
+		{
+			InstanceTransform.SetScale3D(FVector::ZeroVector);
+			ISMComp->UpdateInstanceTransform(InstanceIndex, InstanceTransform, true, true);
+		}
+	}
+	else if (LevelScript != nullptr)
+	{
+		ISMComp->UpdateInstanceTransform(InstanceIndex, LevelScript->GetDestructibleTransform(GlobalInstanceIndex), true, true);
+	}
+}
+
+void UDestructionComponent::RespawnInstance_Implementation(FGameplayTag InstanceTag, int32 InstanceIndex, int32 GlobalInstanceIndex)
+{
+	const FDestructionDataSet* CurrentDataSet = GetDestructionDataSetPtr(InstanceTag);
+
+	if (CurrentDataSet == nullptr || !DestroyedInstances.IsValidIndex(GlobalInstanceIndex))
+	{
+		return;
+	}
+
+	// The instance still owns its ISM slot and health entry, so respawning only resets them
+	DestroyedInstances[GlobalInstanceIndex] = false;
+	WriteInstanceHealth(GlobalInstanceIndex, CurrentDataSet->Health, CurrentDataSet->Health);
+
+	SetInstanceHidden(InstanceTag, InstanceIndex, GlobalInstanceIndex, false);
+	UpdateInstance_Implementation(InstanceTag, InstanceIndex, CurrentDataSet->Health);
+}
+
+float UDestructionComponent::GetDestructibleHealthForIndex(FGameplayTag InstanceTag, int32 InstanceIndex) const
+{
+	float ReturnValue = INDEX_NONE;
+	const int32 GlobalInstanceIndex = GetGlobalInstanceIndex(InstanceTag, InstanceIndex);
+	const FDestructionDataSet* CurrentDataSet = DestructionDataSets.Find(InstanceTag);
+
+	if (GlobalInstanceIndex != INDEX_NONE && CurrentDataSet != nullptr && !DestroyedInstances[GlobalInstanceIndex])
+	{
+		ReturnValue = ReadInstanceHealth(GlobalInstanceIndex, CurrentDataSet->Health);
+	}
+
+	return ReturnValue;
+};
+
+void UDestructionComponent::GetInstanceTransform(FGameplayTag InstanceTag, int32 InstanceIndex, FTransform& InstanceTransform)
+{
+	InstanceTransform = FTransform();
+	const int32 GlobalInstanceIndex = GetGlobalInstanceIndex(InstanceTag, InstanceIndex);
+
+	if (GlobalInstanceIndex == INDEX_NONE)
+	{
+		return;
+	}
+
+	// Living instances are read from the ISM. Destroyed ones are hidden there, so fall back to the cooked level manifest
+	if (!DestroyedInstances[GlobalInstanceIndex])
+	{
+		TObjectPtr<ADestructionActor>* DestructibleActor = DestructibleInstanceActors.Find(InstanceTag);
+
+		if (DestructibleActor != nullptr && *DestructibleActor != nullptr)
+		{
+			(*DestructibleActor)->GetISMComp()->GetInstanceTransform(InstanceIndex, InstanceTransform, true);
+		}
+	}
+	else if (LevelScript != nullptr)
+	{
+		InstanceTransform = LevelScript->GetDestructibleTransform(GlobalInstanceIndex);
+	}
+}
+
+//----------------------------------------------------------------------//
+// Event log
+//----------------------------------------------------------------------//
+uint32 UDestructionComponent::GetEventTick() const
+{
+	const double WorldTime = GetWorld() != nullptr ? GetWorld()->GetTimeSeconds() : EventTimeOrigin;
+
+	return (uint32)FMath::Max(FMath::FloorToInt64((WorldTime - EventTimeOrigin) * EventLogTicksPerSecond), (int64)0);
+}
+
+void UDestructionComponent::RecordEvent(EDestructionEventType EventType, int32 GlobalInstanceIndex, float Damage)
+{
+	// A loaded log has its own timeline, events of this session would break its tick order
+	if (!bRecordDestructionEvents || bEventLogLoaded || LevelScript == nullptr)
+	{
+		return;
+	}
+
+	const uint32 Tick = GetEventTick();
+
+	if (EventLogSnapshotInterval > 0 && Tick >= EventLog.GetLastSnapshotTick() + (uint32)EventLogSnapshotInterval)
+	{
+		AddStateSnapshot();
+	}
+
+	FDestructionEvent Event;
+	Event.Tick = Tick;
+	Event.GlobalInstanceIndex = GlobalInstanceIndex;
+	Event.Damage = Damage;
+	Event.DataSetId = UGameplayTagsManager::Get().GetNetIndexFromTag(LevelScript->GetDestructibleTag(GlobalInstanceIndex));
+	Event.Type = EventType;
+
+	EventLog.Record(Event);
+}
+
+void UDestructionComponent::AddStateSnapshot()
+{
+	FDestructionStateSnapshot Snapshot;
+	Snapshot.Tick = GetEventTick();
+	Snapshot.EventIndex = EventLog.GetEvents().Num();
+	Snapshot.Health = DestructiblesHealth;
+	Snapshot.DestroyedInstances = DestroyedInstances;
+
+	EventLog.AddSnapshot(MoveTemp(Snapshot));
+	EventLog.FlushExport();
+}
+
+bool UDestructionComponent::StartEventLogExport(const FString& Filename)
+{
+	const bool bStarted = EventLog.StartExport(Filename, NumGlobalInstances);
+
+	if (!bStarted)
+	{
+		UE_LOG(LogDestruction, Warning, TEXT("Could not start exporting the destruction event log to %s"), *Filename);
+	}
+
+	return bStarted;
+}
+
+void UDestructionComponent::StopEventLogExport()
+{
+	EventLog.StopExport();
+}
+
+bool UDestructionComponent::LoadEventLog(const FString& Filename)
+{
+	const bool bLoaded = EventLog.Load(Filename, NumGlobalInstances);
+
+	if (!bLoaded)
+	{
+		UE_LOG(LogDestruction, Warning, TEXT("Could not load the destruction event log %s, or it was recorded against a different level manifest"), *Filename);
+		return false;
+	}
+
+	bEventLogLoaded = true;
+
+	if (bRecordDestructionEvents)
+	{
+		UE_LOG(LogDestruction, Log, TEXT("Recording destruction events is paused while the loaded event log %s is active"), *Filename);
+	}
+
+	return true;
+}
+
+bool UDestructionComponent::ReconstructStateAtTick(int32 Tick, FDestructionStateSnapshot& OutState) const
+{
+	const uint32 TargetTick = (uint32)FMath::Max(Tick, 0);
+	const FDestructionStateSnapshot* Snapshot = EventLog.FindSnapshot(TargetTick);
+
+	if (Snapshot == nullptr || LevelScript == nullptr || Snapshot->Health.Num() != DestructiblesHealth.Num())
+	{
+		return false;
+	}
+
+	OutState.Tick = TargetTick;
+	OutState.Health = Snapshot->Health;
+	OutState.DestroyedInstances = Snapshot->DestroyedInstances;
+
+	// Apply all events up to the tick on top of the snapshot
+	const TArray<FDestructionEvent>& Events = EventLog.GetEvents();
+	UGameplayTagsManager& TagsManager = UGameplayTagsManager::Get();
+	int32 NumMismatchedEvents = 0;
+	int32 EventIndex = Snapshot->EventIndex;
+
+	for (; EventIndex < Events.Num() && Events[EventIndex].Tick <= TargetTick; EventIndex++)
+	{
+		const FDestructionEvent& Event = Events[EventIndex];
+
+		if (!OutState.DestroyedInstances.IsValidIndex(Event.GlobalInstanceIndex))
+		{
+			NumMismatchedEvents++;
+			continue;
+		}
+
+		const FGameplayTag& InstanceTag = LevelScript->GetDestructibleTag(Event.GlobalInstanceIndex);
+		const FDestructionDataSet* CurrentDataSet = DestructionDataSets.Find(InstanceTag);
+
+		if (CurrentDataSet == nullptr || TagsManager.GetNetIndexFromTag(InstanceTag) != Event.DataSetId)
+		{
+			NumMismatchedEvents++;
+			continue;
+		}
+
+		switch (Event.Type)
+		{
+		case EDestructionEventType::Destroy:
+			OutState.DestroyedInstances[Event.GlobalInstanceIndex] = true;
+			WriteInstanceHealth(OutState.Health, Event.GlobalInstanceIndex, 0.0f, 0.0f);
+			break;
+		case EDestructionEventType::Respawn:
+			OutState.DestroyedInstances[Event.GlobalInstanceIndex] = false;
+			WriteInstanceHealth(OutState.Health, Event.GlobalInstanceIndex, CurrentDataSet->Health, CurrentDataSet->Health);
+			break;
+		case EDestructionEventType::Repair:
+			if (!OutState.DestroyedInstances[Event.GlobalInstanceIndex])
+			{
+				// Same computation as RepairGlobalInstance, so the replayed health matches the live one exactly
+				const float CurrentHealth = ReadInstanceHealth(OutState.Health, Event.GlobalInstanceIndex, CurrentDataSet->Health);
+				const float NewHealth = FMath::Min(CurrentHealth + Event.Damage, CurrentDataSet->Health);
+
+				if (NewHealth > CurrentHealth)
+				{
+					WriteInstanceHealth(OutState.Health, Event.GlobalInstanceIndex, NewHealth, CurrentDataSet->Health);
+				}
+			}
+			break;
+		default:
+			if (!OutState.DestroyedInstances[Event.GlobalInstanceIndex])
+			{
+				const float NewHealth = ReadInstanceHealth(OutState.Health, Event.GlobalInstanceIndex, CurrentDataSet->Health) - Event.Damage;
+				WriteInstanceHealth(OutState.Health, Event.GlobalInstanceIndex, NewHealth, CurrentDataSet->Health);
+			}
+			break;
+		}
+	}
+
+	OutState.EventIndex = EventIndex;
+
+	if (NumMismatchedEvents > 0)
+	{
+		UE_LOG(LogDestruction, Warning, TEXT("%d destruction events did not match the level manifest while reconstructing tick %u"), NumMismatchedEvents, TargetTick);
+	}
+
+	return true;
+}
+
+bool UDestructionComponent::RollbackToTick(int32 Tick)
+{
+	const uint32 TargetTick = (uint32)FMath::Max(Tick, 0);
+
+	if (!RestoreStateAtTick(TargetTick))
+	{
+		return false;
+	}
+
+	// Later events belong to the timeline that is being discarded, and new ones continue right after the target tick
+	EventLog.Truncate(TargetTick);
+
+	const double WorldTime = GetWorld() != nullptr ? GetWorld()->GetTimeSeconds() : 0.0;
+	EventTimeOrigin = WorldTime - TargetTick / EventLogTicksPerSecond;
+
+	// The loaded timeline is now the live one, so recording can continue on top of it
+	bEventLogLoaded = false;
+
+	return true;
+}
+
+bool UDestructionComponent::RestoreStateAtTick(uint32 Tick)
+{
+	FDestructionStateSnapshot State;
+
+	if (!ReconstructStateAtTick((int32)Tick, State))
+	{
+		return false;
+	}
+
+	// Send the restored state in a few bulk multicasts instead of one per instance. They apply it right away on the server as well.
+	// Chunks hold a multiple of 8 instances, so each one's destroyed bits start on a byte boundary
+	const int32 HealthStride = GetHealthStride();
+	const int32 InstancesPerChunk = FMath::Max((RestoredStateBytesPerRPC / HealthStride) & ~7, 8);
+
+	TArray<uint8> HealthChunk;
+	TArray<uint8> DestroyedChunk;
+
+	for (int32 FirstGlobalInstanceIndex = 0; FirstGlobalInstanceIndex < NumGlobalInstances; FirstGlobalInstanceIndex += InstancesPerChunk)
+	{
+		const int32 NumChunkInstances = FMath::Min(InstancesPerChunk, NumGlobalInstances - FirstGlobalInstanceIndex);
+
+		HealthChunk.Reset();
+		HealthChunk.Append(State.Health.GetData() + FirstGlobalInstanceIndex * HealthStride, NumChunkInstances * HealthStride);
+
+		DestroyedChunk.Reset();
+		DestroyedChunk.SetNumZeroed((NumChunkInstances + 7) / 8);
+
+		for (int32 i = 0; i < NumChunkInstances; i++)
+		{
+			if (State.DestroyedInstances[FirstGlobalInstanceIndex + i])
+			{
+				DestroyedChunk[i / 8] |= 1 << (i % 8);
+			}
+		}
+
+		RestoreInstanceStates(FirstGlobalInstanceIndex, HealthChunk, DestroyedChunk);
+	}
+
+	// Running effects and repairs aren't part of the log and would keep acting on the old timeline
+	DamageOverTimeEffects.Reset();
+	ActiveRepairs.Reset();
+	RebuildRespawnsAtTick(Tick);
+	UpdateComponentTickEnabled();
+
+	return true;
+}
+
+void UDestructionComponent::RestoreInstanceStates_Implementation(int32 FirstGlobalInstanceIndex, const TArray<uint8>& Health, const TArray<uint8>& DestroyedBits)
+{
+	const int32 HealthStride = GetHealthStride();
+	const int32 NumChunkInstances = FMath::Min(Health.Num() / HealthStride, NumGlobalInstances - FirstGlobalInstanceIndex);
+
+	if (LevelScript == nullptr || FirstGlobalInstanceIndex < 0 || NumChunkInstances <= 0 || DestroyedBits.Num() * 8 < NumChunkInstances)
+	{
+		return;
+	}
+
+	FMemory::Memcpy(DestructiblesHealth.GetData() + FirstGlobalInstanceIndex * HealthStride, Health.GetData(), NumChunkInstances * HealthStride);
+
+	for (int32 i = 0; i < NumChunkInstances; i++)
+	{
+		const int32 GlobalInstanceIndex = FirstGlobalInstanceIndex + i;
+		const int32 InstanceIndex = GlobalToLocalIndices[GlobalInstanceIndex];
+
+		// Entries without a data set stay destroyed
+		if (InstanceIndex == INDEX_NONE)
+		{
+			continue;
+		}
+
+		const FGameplayTag& InstanceTag = LevelScript->GetDestructibleTag(GlobalInstanceIndex);
+		const bool bDestroyed = ((DestroyedBits[i / 8] >> (i % 8)) & 1) != 0;
+
+		if (bDestroyed != DestroyedInstances[GlobalInstanceIndex])
+		{
+			DestroyedInstances[GlobalInstanceIndex] = bDestroyed;
+			SetInstanceHidden(InstanceTag, InstanceIndex, GlobalInstanceIndex, bDestroyed);
+		}
+
+		if (!bDestroyed)
+		{
+			UpdateInstance_Implementation(InstanceTag, InstanceIndex, GetDestructibleHealthForIndex(InstanceTag, InstanceIndex));
+		}
+	}
+}
+
+void UDestructionComponent::RebuildRespawnsAtTick(uint32 Tick)
+{
+	RespawnWheel.Reset();
+
+	// Find out when every instance that is destroyed at the tick went down
+	TMap<int32, uint32> DestroyTicks;
+
+	for (const FDestructionEvent& Event : EventLog.GetEvents())
+	{
+		if (Event.Tick > Tick)
+		{
+			break;
+		}
+
+		if (Event.Type == EDestructionEventType::Destroy)
+		{
+			DestroyTicks.Add(Event.GlobalInstanceIndex, Event.Tick);
+		}
+		else if (Event.Type == EDestructionEventType::Respawn)
+		{
+			DestroyTicks.Remove(Event.GlobalInstanceIndex);
+		}
+	}
+
+	for (const TPair<int32, uint32>& DestroyTick : DestroyTicks)
+	{
+		if (!DestroyedInstances.IsValidIndex(DestroyTick.Key) || !DestroyedInstances[DestroyTick.Key])
+		{
+			continue;
+		}
+
+		const FDestructionDataSet* CurrentDataSet = DestructionDataSets.Find(LevelScript->GetDestructibleTag(DestroyTick.Key));
+
+		if (CurrentDataSet != nullptr && CurrentDataSet->RespawnTime > 0.0f)
+		{
+			const float ElapsedTime = float((Tick - DestroyTick.Value) / EventLogTicksPerSecond);
+			RespawnWheel.Schedule(DestroyTick.Key, CurrentDataSet->RespawnTime - ElapsedTime);
+		}
+	}
+}
+
+//----------------------------------------------------------------------//
+// FDestructionDamageOverTimeEffects
+//----------------------------------------------------------------------//
+int32 FDestructionDamageOverTimeEffects::Find(int32 GlobalInstanceIndex, FGameplayTag DamageType) const
+{
+	const int32* EffectIndex = EffectIndices.Find(MakeTuple(GlobalInstanceIndex, DamageType));
+
+	return EffectIndex != nullptr ? *EffectIndex : INDEX_NONE;
+}
+
+void FDestructionDamageOverTimeEffects::Reserve(int32 NumEffects)
+{
+	GlobalInstanceIndices.Reserve(NumEffects);
+	DamageTypes.Reserve(NumEffects);
+	DamagePerSecond.Reserve(NumEffects);
+	RemainingTime.Reserve(NumEffects);
+	PendingDamage.Reserve(NumEffects);
+	ApplyThreshold.Reserve(NumEffects);
+	EffectIndices.Reserve(NumEffects);
+}
+
+void FDestructionDamageOverTimeEffects::Add(int32 GlobalInstanceIndex, FGameplayTag DamageType, float InDamagePerSecond, float Duration, float InApplyThreshold)
+{
+	GlobalInstanceIndices.Add(GlobalInstanceIndex);
+	DamageTypes.Add(DamageType);
+	DamagePerSecond.Add(InDamagePerSecond);
+	RemainingTime.Add(Duration);
+	PendingDamage.Add(0.0f);
+	ApplyThreshold.Add(InApplyThreshold);
+
+	EffectIndices.Add(MakeTuple(GlobalInstanceIndex, DamageType), GlobalInstanceIndices.Num() - 1);
+}
+
+void FDestructionDamageOverTimeEffects::RemoveAtSwap(int32 EffectIndex)
+{
+	const int32 LastIndex = GlobalInstanceIndices.Num() - 1;
+
+	// The last effect moves into the removed slot
+	EffectIndices.Remove(MakeTuple(GlobalInstanceIndices[EffectIndex], DamageTypes[EffectIndex]));
+
+	if (EffectIndex != LastIndex)
+	{
+		EffectIndices.Add(MakeTuple(GlobalInstanceIndices[LastIndex], DamageTypes[LastIndex]), EffectIndex);
+	}
+
+	GlobalInstanceIndices.RemoveAtSwap(EffectIndex, 1, false);
+	DamageTypes.RemoveAtSwap(EffectIndex, 1, false);
+	DamagePerSecond.RemoveAtSwap(EffectIndex, 1, false);
+	RemainingTime.RemoveAtSwap(EffectIndex, 1, false);
+	PendingDamage.RemoveAtSwap(EffectIndex, 1, false);
+	ApplyThreshold.RemoveAtSwap(EffectIndex, 1, false);
+}
+
+void FDestructionDamageOverTimeEffects::Reset()
+{
+	GlobalInstanceIndices.Reset();
+	DamageTypes.Reset();
+	DamagePerSecond.Reset();
+	RemainingTime.Reset();
+	PendingDamage.Reset();
+	ApplyThreshold.Reset();
+	EffectIndices.Reset();
+}
+
+//----------------------------------------------------------------------//
+// FDestructionRepairSet
+//----------------------------------------------------------------------//
+int32 FDestructionRepairSet::Find(int32 GlobalInstanceIndex) const
+{
+	const int32* RepairIndex = RepairIndices.Find(GlobalInstanceIndex);
+
+	return RepairIndex != nullptr ? *RepairIndex : INDEX_NONE;
+}
+
+void FDestructionRepairSet::Reserve(int32 NumRepairs)
+{
+	GlobalInstanceIndices.Reserve(NumRepairs);
+	HealthPerSecond.Reserve(NumRepairs);
+	PendingHealth.Reserve(NumRepairs);
+	ApplyThreshold.Reserve(NumRepairs);
+	RepairIndices.Reserve(NumRepairs);
+}
+
+void FDestructionRepairSet::Add(int32 GlobalInstanceIndex, float InHealthPerSecond, float InApplyThreshold)
+{
+	GlobalInstanceIndices.Add(GlobalInstanceIndex);
+	HealthPerSecond.Add(InHealthPerSecond);
+	PendingHealth.Add(0.0f);
+	ApplyThreshold.Add(InApplyThreshold);
+
+	RepairIndices.Add(GlobalInstanceIndex, GlobalInstanceIndices.Num() - 1);
+}
+
+void FDestructionRepairSet::RemoveAtSwap(int32 RepairIndex)
+{
+	const int32 LastIndex = GlobalInstanceIndices.Num() - 1;
+
+	// The last repair moves into the removed slot
+	RepairIndices.Remove(GlobalInstanceIndices[RepairIndex]);
+
+	if (RepairIndex != LastIndex)
+	{
+		RepairIndices.Add(GlobalInstanceIndices[LastIndex], RepairIndex);
+	}
+
+	GlobalInstanceIndices.RemoveAtSwap(RepairIndex, 1, false);
+	HealthPerSecond.RemoveAtSwap(RepairIndex, 1, false);
+	PendingHealth.RemoveAtSwap(RepairIndex, 1, false);
+	ApplyThreshold.RemoveAtSwap(RepairIndex, 1, false);
+}
+
+void FDestructionRepairSet::Reset()
+{
+	GlobalInstanceIndices.Reset();
+	HealthPerSecond.Reset();
+	PendingHealth.Reset();
+	ApplyThreshold.Reset();
+	RepairIndices.Reset();
+}
+
+//----------------------------------------------------------------------//
+// FDestructionRespawnWheel
+//----------------------------------------------------------------------//
+void FDestructionRespawnWheel::Init(int32 NumSlots, float InSlotDuration)
+{
+	Slots.SetNum(NumSlots);
+	SlotDuration = InSlotDuration;
+	ElapsedTime = 0.0f;
+	CurrentSlot = 0;
+	NumScheduled = 0;
+}
+
+void FDestructionRespawnWheel::Reset()
+{
+	for (TArray<FEntry>& Slot : Slots)
+	{
+		Slot.Reset();
+	}
+
+	ElapsedTime = 0.0f;
+	NumScheduled = 0;
+}
+
+void FDestructionRespawnWheel::Schedule(int32 GlobalInstanceIndex, float Delay)
+{
+	if (Slots.Num() == 0)
+	{
+		return;
+	}
+
+	const int32 NumSteps = FMath::Max(FMath::CeilToInt(Delay / SlotDuration), 1);
+	const int32 TargetSlot = (CurrentSlot + NumSteps) % Slots.Num();
+
+	Slots[TargetSlot].Add({ GlobalInstanceIndex, (NumSteps - 1) / Slots.Num() });
+	NumScheduled++;
+}
+
+void FDestructionRespawnWheel::Advance(float DeltaTime, TArray<int32, TMemStackAllocator<>>& OutDueInstances)
+{
+	if (Slots.Num() == 0)
+	{
+		return;
+	}
+
+	ElapsedTime += DeltaTime;
+
+	while (ElapsedTime >= SlotDuration)
+	{
+		ElapsedTime -= SlotDuration;
+		CurrentSlot = (CurrentSlot + 1) % Slots.Num();
+
+		TArray<FEntry>& Slot = Slots[CurrentSlot];
+
+		for (int32 i = Slot.Num() - 1; i >= 0; i--)
+		{
+			if (Slot[i].Rotations > 0)
+			{
+				Slot[i].Rotations--;
+				continue;
+			}
+
+			OutDueInstances.Add(Slot[i].GlobalInstanceIndex);
+			Slot.RemoveAtSwap(i, 1, false);
+			NumScheduled--;
+		}
+	}
+
+	// Nothing left to wait for, start the next schedule from a clean slot boundary
+	if (NumScheduled == 0)
+	{
+		ElapsedTime = 0.0f;
+	}
+}
+
+//----------------------------------------------------------------------//
+// debug
+//----------------------------------------------------------------------//
+#if WITH_GAMEPLAY_DEBUGGER_MENU
+void UDestructionComponent::DescribeSelfToGameplayDebugger(FGameplayDebuggerCategory* DebuggerCategory)
+{
+	if (DebuggerCategory == nullptr)
+	{
+		return;
+	}
+
+	if (DebuggerCategory)
+	{
+		UWorld* World = GetWorld();
+
+		if (World)
+		{
+			SIZE_T CompactBytes, LegacyBytes;
+			GetInstanceStateMemory(CompactBytes, LegacyBytes);
+
+			DebuggerCategory->AddTextLine(FString::Printf(TEXT("{white}Instances: {yellow}%d {white}State: {yellow}%llu {white}bytes (map based layout: {yellow}%llu {white}bytes)"),
+				NumGlobalInstances, (uint64)CompactBytes, (uint64)LegacyBytes));
+			DebuggerCategory->AddTextLine(FString::Printf(TEXT("{white}Damage over time effects: {yellow}%d {white}Repairs: {yellow}%d {white}Pending respawns: {yellow}%d"),
+				DamageOverTimeEffects.Num(), ActiveRepairs.Num(), RespawnWheel.Num()));
 		}
 	}
 }
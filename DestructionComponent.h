@@ -5,8 +5,12 @@
 #include "CoreMinimal.h"
 #include "DestructionData.h"
 #include "DestructionActor.h"
+#include "DestructionEventLog.h"
 #include "GameplayTagContainer.h"
+#include "Containers/Queue.h"
+#include "Misc/MemStack.h"
 #include "Components/GameStateComponent.h"
+#include <atomic>
 #include "DestructionComponent.generated.h"
 
 // This component is the core of a system that allows UE developers to implement
@@ -17,6 +21,151 @@
 class ADestructionLevelScript;
 class FGameplayDebuggerCategory;
 
+/** How the per-instance health is stored. The quantized modes store health relative to the data set's max health */
+UENUM(BlueprintType)
+enum class EDestructionHealthPrecision : uint8
+{
+	// 32-bit float per instance
+	Full,
+	// 16-bit per instance, 1/65535th of the data set's max health per step
+	Quantized16,
+	// 8-bit per instance, 1/255th of the data set's max health per step
+	Quantized8
+};
+
+/**
+*	All active damage over time effects (burning, corrosion, ...), stored as parallel dense arrays
+*	so the component can advance every effect in one linear pass per tick instead of running per-instance timers
+*/
+struct FDestructionDamageOverTimeEffects
+{
+	/** The global instance index each effect is applied to */
+	TArray<int32> GlobalInstanceIndices;
+
+	/** The damage type of each effect, reapplying the same type to an instance refreshes the effect */
+	TArray<FGameplayTag> DamageTypes;
+
+	/** Damage per second, with the data set's resistance already applied */
+	TArray<float> DamagePerSecond;
+
+	/** Seconds left until each effect runs out */
+	TArray<float> RemainingTime;
+
+	/** Damage accumulated since the last time it was applied to the instance */
+	TArray<float> PendingDamage;
+
+	/**
+	*	Minimum pending damage before it gets applied. Keeps burning instances from sending a visual update every batch tick,
+	*	and quantized health from rounding every small step up to a full one
+	*/
+	TArray<float> ApplyThreshold;
+
+	/** Maps an instance and damage type to its effect, so reapplying or spreading effects doesn't scan all of them */
+	TMap<TPair<int32, FGameplayTag>, int32> EffectIndices;
+
+	int32 Num() const { return GlobalInstanceIndices.Num(); }
+
+	int32 Find(int32 GlobalInstanceIndex, FGameplayTag DamageType) const;
+
+	void Reserve(int32 NumEffects);
+
+	void Add(int32 GlobalInstanceIndex, FGameplayTag DamageType, float InDamagePerSecond, float Duration, float InApplyThreshold);
+
+	void RemoveAtSwap(int32 EffectIndex);
+
+	void Reset();
+};
+
+/** Damage submitted from any thread, waiting to be applied on the game thread */
+struct FDestructionSubmittedDamage
+{
+	/** The hit destruction actor, only resolved on the game thread */
+	FActorInstanceHandle HitObjectHandle;
+
+	/** The hit ISM instance index */
+	int32 InstanceIndex = INDEX_NONE;
+
+	float Damage = 0.0f;
+
+	FGameplayTag DamageType;
+
+	/** Resolved while draining, used to put the batch into a deterministic order */
+	int32 GlobalInstanceIndex = INDEX_NONE;
+};
+
+/**
+*	The sparse set of instances that are currently being repaired over time.
+*	Only repairing instances are stored, so the cost of a tick scales with them and not with all instances
+*/
+struct FDestructionRepairSet
+{
+	/** The global instance index of each repairing instance */
+	TArray<int32> GlobalInstanceIndices;
+
+	/** Health restored per second */
+	TArray<float> HealthPerSecond;
+
+	/** Health accumulated since the last time it was applied to the instance */
+	TArray<float> PendingHealth;
+
+	/** Minimum pending health before it gets applied, like the damage over time effects' threshold */
+	TArray<float> ApplyThreshold;
+
+	/** Maps an instance to its repair, so starting and stopping repairs doesn't scan all of them */
+	TMap<int32, int32> RepairIndices;
+
+	int32 Num() const { return GlobalInstanceIndices.Num(); }
+
+	int32 Find(int32 GlobalInstanceIndex) const;
+
+	void Reserve(int32 NumRepairs);
+
+	void Add(int32 GlobalInstanceIndex, float InHealthPerSecond, float InApplyThreshold);
+
+	void RemoveAtSwap(int32 RepairIndex);
+
+	void Reset();
+};
+
+/**
+*	A hashed timing wheel that holds destroyed instances until they respawn.
+*	Advancing it only visits the instances in the current slot, and the slots keep their capacity so a warmed up wheel doesn't allocate
+*/
+struct FDestructionRespawnWheel
+{
+	void Init(int32 NumSlots, float InSlotDuration);
+
+	void Schedule(int32 GlobalInstanceIndex, float Delay);
+
+	/** Advance the wheel and append every instance that is due to OutDueInstances */
+	void Advance(float DeltaTime, TArray<int32, TMemStackAllocator<>>& OutDueInstances);
+
+	int32 Num() const { return NumScheduled; }
+
+	/** Drop everything that is scheduled, keeping the slots' capacity */
+	void Reset();
+
+private:
+
+	struct FEntry
+	{
+		int32 GlobalInstanceIndex;
+
+		/** Full turns of the wheel left before the entry is due */
+		int32 Rotations;
+	};
+
+	TArray<TArray<FEntry>> Slots;
+
+	float SlotDuration = 0.0f;
+
+	float ElapsedTime = 0.0f;
+
+	int32 CurrentSlot = 0;
+
+	int32 NumScheduled = 0;
+};
+
 UCLASS(Blueprintable, meta = (BlueprintSpawnableComponent))
 class GUNZILLATEST_API UDestructionComponent : public UGameStateComponent
 {
@@ -35,29 +184,167 @@ public:
 
 	//~UActorComponent interface
 	virtual void BeginPlay() override;
+	virtual void EndPlay(const EEndPlayReason::Type EndPlayReason) override;
+	virtual void TickComponent(float DeltaTime, enum ELevelTick TickType, FActorComponentTickFunction* ThisTickFunction) override;
 	//~End of UActorComponent interface
 
 	/** Apply damage to a list of hit results */
 	UFUNCTION(BlueprintCallable, BlueprintAuthorityOnly, Category = "Destruction Component")
-	void ApplyDamageToHitResult(FHitResult HitResult, const float Damage);
+	void ApplyDamageToHitResult(const FHitResult& HitResult, const float Damage);
+
+	/** Apply damage of a given type to a hit result, reduced by the data set's resistance against that type */
+	UFUNCTION(BlueprintCallable, BlueprintAuthorityOnly, Category = "Destruction Component")
+	void ApplyTypedDamageToHitResult(const FHitResult& HitResult, const float Damage, FGameplayTag DamageType);
+
+	/** Start a damage over time effect on a hit result. Applying the same damage type again refreshes the effect */
+	UFUNCTION(BlueprintCallable, BlueprintAuthorityOnly, Category = "Destruction Component")
+	void ApplyDamageOverTimeToHitResult(const FHitResult& HitResult, const float DamagePerSecond, const float Duration, FGameplayTag DamageType);
+
+	/** Start streaming the destruction event log to a file, including all events recorded so far */
+	UFUNCTION(BlueprintCallable, Category = "Destruction Component|Replay")
+	bool StartEventLogExport(const FString& Filename);
+
+	UFUNCTION(BlueprintCallable, Category = "Destruction Component|Replay")
+	void StopEventLogExport();
+
+	/** Replace the recorded events with an exported event log, e.g. to play back a demo. Recording is paused until RollbackToTick continues from it */
+	UFUNCTION(BlueprintCallable, Category = "Destruction Component|Replay")
+	bool LoadEventLog(const FString& Filename);
+
+	/**
+	*	Reconstruct the destruction state as it was at the given tick into OutState, from the closest snapshot plus the recorded events,
+	*	e.g. to play back a demo or investigate a desync report. The live match state and the log are left untouched
+	*/
+	bool ReconstructStateAtTick(int32 Tick, FDestructionStateSnapshot& OutState) const;
+
+	/**
+	*	Server-side rollback. Puts the live state back to the given tick, dropping running damage over time effects and repairs
+	*	and rebuilding pending respawns from the log. Every later event and snapshot is dropped, and the event log clock continues from that tick.
+	*	Clients are sent the restored state in a few bulk multicasts.
+	*/
+	UFUNCTION(BlueprintCallable, BlueprintAuthorityOnly, Category = "Destruction Component|Replay")
+	bool RollbackToTick(int32 Tick);
+
+	/**
+	*	Thread-safe. Queue damage from any thread, e.g. projectile simulation or async traces on task graph workers.
+	*	Submitted damage is applied on the game thread during the component's next tick, in an order that does not depend on thread timing.
+	*	Only has an effect on the authority, submissions on clients are ignored.
+	*/
+	void SubmitDamage(const FHitResult& HitResult, const float Damage, FGameplayTag DamageType = FGameplayTag());
+
+	/** Instantly restore health of a hit instance, up to its data set's max health */
+	UFUNCTION(BlueprintCallable, BlueprintAuthorityOnly, Category = "Destruction Component")
+	void RepairHitResult(const FHitResult& HitResult, const float Amount);
+
+	/** Repair a hit instance over time until it is back at full health. Calling this again changes the repair rate */
+	UFUNCTION(BlueprintCallable, BlueprintAuthorityOnly, Category = "Destruction Component")
+	void StartRepairingHitResult(const FHitResult& HitResult, const float HealthPerSecond);
+
+	UFUNCTION(BlueprintCallable, BlueprintAuthorityOnly, Category = "Destruction Component")
+	void StopRepairingHitResult(const FHitResult& HitResult);
+
+	/**
+	*	How the per-instance health is stored, quantized modes save memory e.g. on dedicated servers.
+	*	They round health to the nearest step, only a hit or repair smaller than half a step is rounded up to a full one so it isn't lost
+	*/
+	UPROPERTY(EditDefaultsOnly, Category = "Destruction Component")
+	EDestructionHealthPrecision HealthPrecision = EDestructionHealthPrecision::Full;
+
+	/** How many times per second the batched work is advanced: damage over time effects, repairs and respawn timers. Submitted damage is applied every frame */
+	UPROPERTY(EditDefaultsOnly, Category = "Destruction Component", meta = (ClampMin = "1.0", UIMin = "1.0"))
+	float BatchTickRate = 10.0f;
+
+	/** Smallest health change, as a fraction of the data set's max health, that damage and repairs over time apply at once. Every application sends a visual update */
+	UPROPERTY(EditDefaultsOnly, Category = "Destruction Component", meta = (ClampMin = "0.0", ClampMax = "1.0"))
+	float MinHealthUpdateFraction = 0.01f;
+
+	/** Record every damage and destroy event so the destruction state can be replayed or exported */
+	UPROPERTY(EditDefaultsOnly, Category = "Destruction Component|Replay")
+	bool bRecordDestructionEvents = false;
+
+	/** Event log ticks between state snapshots while recording. More snapshots make reconstructing faster and cost a health array copy each. 0 only keeps the initial one */
+	UPROPERTY(EditDefaultsOnly, Category = "Destruction Component|Replay", meta = (ClampMin = "0"))
+	int32 EventLogSnapshotInterval = 0;
+
+	/** Events reserved up front while recording, so recording a hit doesn't allocate until the log outgrows it. Each event takes 16 bytes */
+	UPROPERTY(EditDefaultsOnly, Category = "Destruction Component|Replay", meta = (ClampMin = "0"))
+	int32 ReservedEventLogCapacity = 4096;
+
+	/** Capacity reserved up front for damage over time effects and repairs, so the batch tick doesn't allocate in a typical match */
+	UPROPERTY(EditDefaultsOnly, Category = "Destruction Component", meta = (ClampMin = "0"))
+	int32 ReservedBatchCapacity = 256;
 
 private:
 	
-	/** get the destruction data set for a given destruction tag */
+	/** get the destruction data set for a given destruction tag. Returns a copy for Blueprints, C++ should use GetDestructionDataSetPtr */
 	UFUNCTION(BlueprintPure, Category = "Destruction Component")
 	FDestructionDataSet GetDestructionDataSet(FGameplayTag DestructionTag);
 	FDestructionDataSet* GetDestructionDataSetPtr(FGameplayTag DestructionTag);
 
 	/** Apply damage to a instance */
 	void ApplyDamageToInstance(FGameplayTag InstanceTag, int32 InstanceIndex, float Damage);
+	void ApplyDamageToGlobalInstance(int32 GlobalInstanceIndex, float Damage);
+
+	/** Scale damage by the data set's resistance against the damage type */
+	float GetResistedDamage(const FDestructionDataSet& DataSet, float Damage, FGameplayTag DamageType) const;
+
+	/** Smallest health change the current HealthPrecision can represent for a data set */
+	float GetHealthQuantum(const FDestructionDataSet& DataSet) const;
+
+	/** The pending damage or repair a batch entry holds back before applying it, from MinHealthUpdateFraction and the health quantum */
+	float GetMinHealthUpdate(const FDestructionDataSet& DataSet) const;
+
+	/** Advance all damage over time effects in one batch */
+	void TickDamageOverTime(float DeltaTime);
+
+	/** Advance all running repairs in one batch */
+	void TickRepairs(float DeltaTime);
+
+	/** Respawn every destroyed instance whose timer ran out */
+	void TickRespawns(float DeltaTime);
+
+	/** Only tick while there is submitted damage to apply, or effects, repairs or respawns to advance */
+	void UpdateComponentTickEnabled();
+
+	/** Apply all damage submitted since the last tick as one batch */
+	void DrainSubmittedDamage();
+
+	/** Restore health of an instance, clamped to its data set's max health. Returns true once it is fully repaired */
+	bool RepairGlobalInstance(int32 GlobalInstanceIndex, float Amount);
+
+	UFUNCTION(NetMulticast, Reliable)
+	void RespawnInstance(FGameplayTag InstanceTag, int32 InstanceIndex, int32 GlobalInstanceIndex);
+
+	/** Hide a destroyed instance in its ISM, or restore its manifest transform. The ISM slot is kept either way */
+	void SetInstanceHidden(FGameplayTag InstanceTag, int32 InstanceIndex, int32 GlobalInstanceIndex, bool bHidden);
+
+	/** Event log ticks since this component began play, the time base of the event log */
+	uint32 GetEventTick() const;
+
+	/** Event log ticks per second of world time */
+	static constexpr double EventLogTicksPerSecond = 60.0;
+
+	/** Put the live state back to the given tick, for RollbackToTick */
+	bool RestoreStateAtTick(uint32 Tick);
+
+	/** Apply the restored state of a range of instances after a rollback, with one destroyed bit per instance */
+	UFUNCTION(NetMulticast, Reliable)
+	void RestoreInstanceStates(int32 FirstGlobalInstanceIndex, const TArray<uint8>& Health, const TArray<uint8>& DestroyedBits);
+
+	/** Upper bound of health bytes sent per RestoreInstanceStates call, keeps each reliable multicast well below the bunch size limits */
+	static constexpr int32 RestoredStateBytesPerRPC = 16 * 1024;
+
+	/** Reschedule the respawn of every instance that is destroyed at the given tick, based on when the log says it was destroyed */
+	void RebuildRespawnsAtTick(uint32 Tick);
+
+	void RecordEvent(EDestructionEventType EventType, int32 GlobalInstanceIndex, float Damage);
+
+	void AddStateSnapshot();
 
 	/** Get the transform of a given instance index */
 	UFUNCTION(BlueprintPure, Category = "Destruction Component")
 	void GetInstanceTransform(FGameplayTag InstanceTag, int32 InstanceIndex, FTransform& InstanceTransform);
 
-	// World data
-	TMap<int32, float> GetDestructibleHealth() { return DestructiblesHealth; };
-
 	float GetDestructibleHealthForIndex(FGameplayTag InstanceTag, int32 InstanceIndex) const;
 
 	void GetDestructionDataAssets();
@@ -66,7 +353,7 @@ private:
 
 	TObjectPtr<ADestructionActor> SpawnNewDestructionActor(FGameplayTag InstanceTag, FDestructionDataSet* CurrentDataSet);
 
-	void AddNewDestructionInstance(FGameplayTag InstanceTag, FDestructionDataSet* CurrentDataSet, TObjectPtr<ADestructionActor> DestructibleActor, FTransform CurrentTransform);
+	void AddNewDestructionInstance(FGameplayTag InstanceTag, int32 GlobalInstanceIndex, FDestructionDataSet* CurrentDataSet, TObjectPtr<ADestructionActor> DestructibleActor, const FTransform& CurrentTransform);
 
 	UFUNCTION(NetMulticast, Reliable)
 	void UpdateInstance(FGameplayTag InstanceTag, int32 InstanceIndex, float NewHealth);
@@ -76,6 +363,22 @@ private:
 
 	int32 GetGlobalInstanceIndex(FGameplayTag InstanceTag, int32 InstanceIndex) const;
 
+	/** Number of bytes a single instance's health takes up in DestructiblesHealth */
+	int32 GetHealthStride() const;
+
+	/** Read and write the health of an instance, (de)quantized against the max health of its data set. Writing returns the health as it was stored */
+	float ReadInstanceHealth(int32 GlobalInstanceIndex, float MaxHealth) const;
+	float WriteInstanceHealth(int32 GlobalInstanceIndex, float NewHealth, float MaxHealth);
+
+	/** Same as above on a health buffer other than the live one, e.g. a reconstructed state */
+	float ReadInstanceHealth(const TArray<uint8>& Health, int32 GlobalInstanceIndex, float MaxHealth) const;
+	float WriteInstanceHealth(TArray<uint8>& Health, int32 GlobalInstanceIndex, float NewHealth, float MaxHealth) const;
+
+	/** Bytes currently held by the per-instance state, and what the same instances cost in the previous map based layout */
+	void GetInstanceStateMemory(SIZE_T& OutCompactBytes, SIZE_T& OutLegacyBytes) const;
+
+	void LogInstanceStateMemory() const;
+
 	// List of destruction data assets
 	TArray<FAssetData> DestructionDataAssetList;
 
@@ -83,27 +386,68 @@ private:
 	UPROPERTY()
 	TMap<FGameplayTag, FDestructionDataSet> DestructionDataSets;
 
-	/** The number of all instances */
+	/** The number of all instances. The global instance index is the index into the level script's manifest */
 	int32 NumGlobalInstances;
 
 	/** List of all destructibles' instanced static mesh instances */
 	TMap<FGameplayTag, TObjectPtr<ADestructionActor>> DestructibleInstanceActors;
 
-	/** List of all destructibles' indeces that is reflected in the TMaps below */
-	TMap<FGameplayTag, TMap<int32, int32>> DestructiblesIndices;
+	/**
+	*	Per destructible tag, maps the ISM instance index to the global instance index.
+	*	Destroyed instances keep their ISM slot, so these indices never shift.
+	*/
+	TMap<FGameplayTag, TArray<int32>> DestructiblesIndices;
 
-	/** List of all destructibles' current total health */
-	TMap<int32, float> DestructiblesHealth;
+	/** Maps the global instance index back to its ISM instance index */
+	TArray<int32> GlobalToLocalIndices;
 
 	/**
-	*	List of all destructibles' transforms.
-	*	Keep us from having to access the ISM comp to get them
+	*	List of all destructibles' current health, indexed by global instance index.
+	*	Raw bytes, GetHealthStride() per instance depending on HealthPrecision.
+	*	Transforms are not duplicated here, they are read from the ISM or the level script manifest when needed.
 	*/
-	TMap<int32, FTransform> DestructibleInstanceTransforms;
+	TArray<uint8> DestructiblesHealth;
+
+	/** One bit per global instance, set once the instance is destroyed or has no data set */
+	TBitArray<> DestroyedInstances;
+
+	/** All active damage over time effects */
+	FDestructionDamageOverTimeEffects DamageOverTimeEffects;
+
+	/** All instances that are being repaired over time */
+	FDestructionRepairSet ActiveRepairs;
+
+	/** Destroyed instances waiting to respawn */
+	FDestructionRespawnWheel RespawnWheel;
+
+	/** Slots of the respawn wheel, one per batch tick. Respawn times longer than a full turn wait for further turns */
+	static constexpr int32 RespawnWheelSlots = 256;
+
+	/** Time accumulated towards the next damage over time, repair and respawn step */
+	float TimeSinceBatchTick = 0.0f;
+
+	/** Damage submitted from any thread, drained on the game thread once per tick */
+	TQueue<FDestructionSubmittedDamage, EQueueMode::Mpsc> SubmittedDamage;
+
+	/** Set by the first submission after a drain, so only that one wakes up the component tick */
+	std::atomic<bool> bSubmittedDamagePending { false };
+
+	/** Every recorded damage and destroy event, plus the state snapshots to replay them from */
+	FDestructionEventLog EventLog;
+
+	/** The world time the event log's tick 0 corresponds to */
+	double EventTimeOrigin = 0.0;
+
+	/** Set while the event log holds a loaded log instead of this session's recording */
+	bool bEventLogLoaded = false;
 
 	/** A reference to the levelscript actor, needed to read the initial destructible pieces setup data */
 	TObjectPtr<ADestructionLevelScript> LevelScript;
 
+#if WITH_DEV_AUTOMATION_TESTS
+	friend struct FDestructionComponentTestHelper;
+#endif //WITH_DEV_AUTOMATION_TESTS
+
 #if WITH_GAMEPLAY_DEBUGGER_MENU
 public:
 
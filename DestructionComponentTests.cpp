@@ -0,0 +1,757 @@
+// Copyright 2024, Talos Interactive, LLC. All Rights Reserved.
+
+#include "DestructionComponent.h"
+#include "DestructionData.h"
+#include "DestructionActor.h"
+#include "DestructionLevelScript.h"
+#include "Misc/AutomationTest.h"
+#include "Engine/Engine.h"
+#include "Engine/World.h"
+#include "Engine/Level.h"
+#include "Curves/CurveLinearColor.h"
+#include "Async/TaskGraphInterfaces.h"
+#include "HAL/MemoryBase.h"
+#include "HAL/FileManager.h"
+#include "Misc/Paths.h"
+#include "NativeGameplayTags.h"
+#include <atomic>
+
+#if WITH_DEV_AUTOMATION_TESTS
+
+UE_DEFINE_GAMEPLAY_TAG_STATIC(TAG_DestructionTest_Piece, "Destruction.Test.Piece");
+UE_DEFINE_GAMEPLAY_TAG_STATIC(TAG_DestructionTest_Fire, "Destruction.Test.Damage.Fire");
+UE_DEFINE_GAMEPLAY_TAG_STATIC(TAG_DestructionTest_Napalm, "Destruction.Test.Damage.Fire.Napalm");
+UE_DEFINE_GAMEPLAY_TAG_STATIC(TAG_DestructionTest_Explosive, "Destruction.Test.Damage.Explosive");
+UE_DEFINE_GAMEPLAY_TAG_STATIC(TAG_DestructionTest_Ballistic, "Destruction.Test.Damage.Ballistic");
+UE_DEFINE_GAMEPLAY_TAG_STATIC(TAG_DestructionTest_Acid, "Destruction.Test.Damage.Acid");
+
+/**
+*	Sets up a game world with a single destructible tag, without depending on the project's destruction data assets.
+*	Setup can change the data set and the component's properties before the component begins play
+*/
+struct FDestructionComponentTestHelper
+{
+	FDestructionComponentTestHelper(int32 NumInstances, float Health, EDestructionHealthPrecision HealthPrecision, bool bRecordEvents = false,
+		TFunction<void(FDestructionDataSet&, UDestructionComponent&)> Setup = nullptr)
+	{
+		World = UWorld::CreateWorld(EWorldType::Game, false);
+		FWorldContext& WorldContext = GEngine->CreateNewWorldContext(EWorldType::Game);
+		WorldContext.SetCurrentWorld(World);
+
+		// The component reads its manifest from the level script, so the test world needs one
+		ADestructionLevelScript* LevelScript = World->SpawnActor<ADestructionLevelScript>();
+
+		for (int32 i = 0; i < NumInstances; i++)
+		{
+			LevelScript->DestructibleTags.Add(TAG_DestructionTest_Piece);
+			LevelScript->DestructibleTransforms.Add(FTransform(FVector(i * 200.0, 0.0, 0.0)));
+		}
+
+		World->PersistentLevel->LevelScriptActor = LevelScript;
+
+		FDestructionDataSet DataSet;
+		DataSet.Mesh = LoadObject<UStaticMesh>(nullptr, TEXT("/Engine/BasicShapes/Cube.Cube"));
+		DataSet.Health = Health;
+		DataSet.HealthStateColorCurve = NewObject<UCurveLinearColor>(World);
+
+		AActor* Owner = World->SpawnActor<AActor>();
+
+		Component = NewObject<UDestructionComponent>(Owner);
+		Component->HealthPrecision = HealthPrecision;
+		Component->bRecordDestructionEvents = bRecordEvents;
+
+		if (Setup)
+		{
+			Setup(DataSet, *Component);
+		}
+
+		Component->DestructionDataSets.Add(TAG_DestructionTest_Piece, DataSet);
+		Component->RegisterComponent();
+		Component->BeginPlay();
+
+		DestructionActor = Component->DestructibleInstanceActors.FindRef(TAG_DestructionTest_Piece);
+	}
+
+	~FDestructionComponentTestHelper()
+	{
+		GEngine->DestroyWorldContext(World);
+		World->DestroyWorld(false);
+	}
+
+	FHitResult MakeHitResult(int32 InstanceIndex) const
+	{
+		FHitResult HitResult;
+		HitResult.HitObjectHandle = FActorInstanceHandle(DestructionActor);
+		HitResult.Item = InstanceIndex;
+		return HitResult;
+	}
+
+	float GetHealth(int32 InstanceIndex) const
+	{
+		return Component->GetDestructibleHealthForIndex(TAG_DestructionTest_Piece, InstanceIndex);
+	}
+
+	const TArray<uint8>& GetHealthData() const { return Component->DestructiblesHealth; }
+
+	int32 GetNumEvents() const { return Component->EventLog.GetEvents().Num(); }
+
+	void DrainSubmittedDamage() { Component->DrainSubmittedDamage(); }
+
+	/** Advance the world clock and the component's batched work directly, instead of waiting for the component tick */
+	void AdvanceBatch(float DeltaTime)
+	{
+		World->TimeSeconds += DeltaTime;
+		Component->TickDamageOverTime(DeltaTime);
+		Component->TickRepairs(DeltaTime);
+		Component->TickRespawns(DeltaTime);
+	}
+
+	bool IsDestroyed(int32 InstanceIndex) const
+	{
+		return Component->DestroyedInstances[Component->GetGlobalInstanceIndex(TAG_DestructionTest_Piece, InstanceIndex)];
+	}
+
+	const TBitArray<>& GetDestroyedInstances() const { return Component->DestroyedInstances; }
+
+	const TArray<FDestructionEvent>& GetEvents() const { return Component->EventLog.GetEvents(); }
+
+	uint32 GetEventTick() const { return Component->GetEventTick(); }
+
+	int32 GetNumScheduledRespawns() const { return Component->RespawnWheel.Num(); }
+
+	int32 GetNumActiveRepairs() const { return Component->ActiveRepairs.Num(); }
+
+	int32 GetNumDamageOverTimeEffects() const { return Component->DamageOverTimeEffects.Num(); }
+
+	bool HasDamageOverTimeEffect(int32 InstanceIndex, FGameplayTag DamageType) const
+	{
+		return Component->DamageOverTimeEffects.Find(Component->GetGlobalInstanceIndex(TAG_DestructionTest_Piece, InstanceIndex), DamageType) != INDEX_NONE;
+	}
+
+	UWorld* World = nullptr;
+	UDestructionComponent* Component = nullptr;
+	ADestructionActor* DestructionActor = nullptr;
+};
+
+IMPLEMENT_SIMPLE_AUTOMATION_TEST(FDestructionSubmitDamageStressTest, "Destruction.Component.SubmitDamageStress", EAutomationTestFlags::ApplicationContextMask | EAutomationTestFlags::ProductFilter)
+
+bool FDestructionSubmitDamageStressTest::RunTest(const FString& Parameters)
+{
+	constexpr int32 NumInstances = 64;
+	constexpr int32 NumProducers = 16;
+	constexpr int32 SubmissionsPerProducer = 2000;
+	constexpr int32 NumRuns = 3;
+	constexpr float Health = 100000.0f;
+
+	// Uneven amounts, so a result that depends on the order the producers ran in would show up as a different float sum
+	auto GetSubmittedDamage = [](int32 Producer, int32 Submission)
+	{
+		return 0.1f * (1 + (Producer * 7 + Submission) % 13);
+	};
+
+	auto GetSubmittedInstance = [](int32 Producer, int32 Submission)
+	{
+		return (Producer * 5 + Submission) % NumInstances;
+	};
+
+	TArray<double> ExpectedDamage;
+	ExpectedDamage.SetNumZeroed(NumInstances);
+
+	for (int32 Producer = 0; Producer < NumProducers; Producer++)
+	{
+		for (int32 Submission = 0; Submission < SubmissionsPerProducer; Submission++)
+		{
+			ExpectedDamage[GetSubmittedInstance(Producer, Submission)] += GetSubmittedDamage(Producer, Submission);
+		}
+	}
+
+	TArray<uint8> FirstRunHealth;
+
+	for (int32 Run = 0; Run < NumRuns; Run++)
+	{
+		FDestructionComponentTestHelper Helper(NumInstances, Health, EDestructionHealthPrecision::Full, true);
+
+		if (!TestNotNull(TEXT("Destruction actor spawned"), Helper.DestructionActor))
+		{
+			return false;
+		}
+
+		const int32 NumInitialEvents = Helper.GetNumEvents();
+
+		// Hit results are built up front on the game thread, the producers only read them
+		TArray<FHitResult> HitResults;
+
+		for (int32 i = 0; i < NumInstances; i++)
+		{
+			HitResults.Add(Helper.MakeHitResult(i));
+		}
+
+		FGraphEventArray Producers;
+
+		for (int32 Producer = 0; Producer < NumProducers; Producer++)
+		{
+			Producers.Add(FFunctionGraphTask::CreateAndDispatchWhenReady([&Helper, &HitResults, &GetSubmittedDamage, &GetSubmittedInstance, Producer]()
+			{
+				for (int32 Submission = 0; Submission < SubmissionsPerProducer; Submission++)
+				{
+					Helper.Component->SubmitDamage(HitResults[GetSubmittedInstance(Producer, Submission)], GetSubmittedDamage(Producer, Submission));
+				}
+			}, TStatId(), nullptr, ENamedThreads::AnyBackgroundThreadNormalTask));
+		}
+
+		FTaskGraphInterface::Get().WaitUntilTasksComplete(Producers, ENamedThreads::GameThread);
+
+		Helper.DrainSubmittedDamage();
+
+		// Everything was consumed by the first drain, a second one must not apply anything again
+		Helper.DrainSubmittedDamage();
+
+		for (int32 i = 0; i < NumInstances; i++)
+		{
+			TestEqual(FString::Printf(TEXT("Run %d, instance %d health"), Run, i), Helper.GetHealth(i), Health - static_cast<float>(ExpectedDamage[i]), 0.5f);
+		}
+
+		// The drain sums the damage per instance, so each instance gets exactly one damage event
+		TestEqual(FString::Printf(TEXT("Run %d damage events"), Run), Helper.GetNumEvents() - NumInitialEvents, NumInstances);
+
+		if (Run == 0)
+		{
+			FirstRunHealth = Helper.GetHealthData();
+		}
+		else
+		{
+			TestTrue(FString::Printf(TEXT("Run %d health matches the first run bit for bit"), Run), Helper.GetHealthData() == FirstRunHealth);
+		}
+	}
+
+	return true;
+}
+
+/** Forwards to the engine allocator, and counts the allocations made on the game thread while installed as GMalloc */
+class FDestructionCountingMalloc final : public FMalloc
+{
+public:
+
+	explicit FDestructionCountingMalloc(FMalloc* InInnerMalloc) : InnerMalloc(InInnerMalloc) {}
+
+	virtual void* Malloc(SIZE_T Count, uint32 Alignment) override
+	{
+		CountAllocation();
+		return InnerMalloc->Malloc(Count, Alignment);
+	}
+
+	virtual void* Realloc(void* Original, SIZE_T Count, uint32 Alignment) override
+	{
+		// Reallocating to 0 only frees
+		if (Count > 0)
+		{
+			CountAllocation();
+		}
+
+		return InnerMalloc->Realloc(Original, Count, Alignment);
+	}
+
+	virtual void Free(void* Original) override { InnerMalloc->Free(Original); }
+	virtual SIZE_T QuantizeSize(SIZE_T Count, uint32 Alignment) override { return InnerMalloc->QuantizeSize(Count, Alignment); }
+	virtual bool GetAllocationSize(void* Original, SIZE_T& SizeOut) override { return InnerMalloc->GetAllocationSize(Original, SizeOut); }
+	virtual void Trim(bool bTrimThreadCaches) override { InnerMalloc->Trim(bTrimThreadCaches); }
+	virtual void SetupTLSCachesOnCurrentThread() override { InnerMalloc->SetupTLSCachesOnCurrentThread(); }
+	virtual void ClearAndDisableTLSCachesOnCurrentThread() override { InnerMalloc->ClearAndDisableTLSCachesOnCurrentThread(); }
+	virtual bool IsInternallyThreadSafe() const override { return InnerMalloc->IsInternallyThreadSafe(); }
+	virtual const TCHAR* GetDescriptiveName() override { return TEXT("DestructionCountingMalloc"); }
+
+	FMalloc* GetInnerMalloc() const { return InnerMalloc; }
+
+	std::atomic<int32> NumAllocations = 0;
+
+private:
+
+	void CountAllocation()
+	{
+		// Worker threads keep allocating for their own work, only the game thread runs the damage path
+		if (IsInGameThread())
+		{
+			NumAllocations++;
+		}
+	}
+
+	FMalloc* InnerMalloc;
+};
+
+/** Counts the game thread allocations made within its scope */
+struct FDestructionScopedAllocationCounter
+{
+	FDestructionScopedAllocationCounter()
+	{
+		// Never destroyed, a thread that read GMalloc just before it is restored may still call into it
+		static FDestructionCountingMalloc CountingMalloc(GMalloc);
+
+		Malloc = &CountingMalloc;
+		Malloc->NumAllocations = 0;
+		GMalloc = Malloc;
+	}
+
+	~FDestructionScopedAllocationCounter()
+	{
+		GMalloc = Malloc->GetInnerMalloc();
+	}
+
+	int32 GetNumAllocations() const { return Malloc->NumAllocations; }
+
+	FDestructionCountingMalloc* Malloc;
+};
+
+IMPLEMENT_SIMPLE_AUTOMATION_TEST(FDestructionDamageAllocationTest, "Destruction.Component.DamageAllocations", EAutomationTestFlags::ApplicationContextMask | EAutomationTestFlags::ProductFilter)
+
+bool FDestructionDamageAllocationTest::RunTest(const FString& Parameters)
+{
+	constexpr int32 NumInstances = 32;
+	constexpr int32 NumMeasuredHitsPerInstance = 8;
+	constexpr float Health = 1000.0f;
+	constexpr float Damage = 1.0f;
+
+	const EDestructionHealthPrecision Precisions[] = { EDestructionHealthPrecision::Full, EDestructionHealthPrecision::Quantized16, EDestructionHealthPrecision::Quantized8 };
+
+	for (const EDestructionHealthPrecision HealthPrecision : Precisions)
+	{
+		FDestructionComponentTestHelper Helper(NumInstances, Health, HealthPrecision, true);
+
+		if (!TestNotNull(TEXT("Destruction actor spawned"), Helper.DestructionActor))
+		{
+			return false;
+		}
+
+		TArray<FHitResult> HitResults;
+
+		for (int32 i = 0; i < NumInstances; i++)
+		{
+			HitResults.Add(Helper.MakeHitResult(i));
+		}
+
+		// Warm up, the first hits fill lazily created engine state such as the end of frame update list
+		for (const FHitResult& HitResult : HitResults)
+		{
+			Helper.Component->ApplyDamageToHitResult(HitResult, Damage);
+		}
+
+		Helper.World->SendAllEndOfFrameUpdates();
+
+		/**
+			Only the damage call itself is counted. The render state updates it queues are sent at the end of the frame,
+			like they would be in a running game. In a standalone world the multicasts run locally, so this covers
+			the component's own work but not the net driver's once the multicasts go out to clients.
+		*/
+		int32 MaxAllocations = 0;
+
+		for (int32 Hit = 0; Hit < NumMeasuredHitsPerInstance; Hit++)
+		{
+			for (const FHitResult& HitResult : HitResults)
+			{
+				int32 NumAllocations = 0;
+
+				{
+					FDestructionScopedAllocationCounter AllocationCounter;
+					Helper.Component->ApplyDamageToHitResult(HitResult, Damage);
+					NumAllocations = AllocationCounter.GetNumAllocations();
+				}
+
+				MaxAllocations = FMath::Max(MaxAllocations, NumAllocations);
+
+				Helper.World->SendAllEndOfFrameUpdates();
+			}
+		}
+
+		TestEqual(FString::Printf(TEXT("Heap allocations per damage call with %s health"), *UEnum::GetValueAsString(HealthPrecision)), MaxAllocations, 0);
+
+		// Make sure the hits were actually applied and recorded, and not skipped
+		TestTrue(TEXT("Damage was applied"), Helper.GetHealth(0) < Health);
+		TestEqual(TEXT("Every hit was recorded"), Helper.GetNumEvents(), NumInstances * (NumMeasuredHitsPerInstance + 1));
+	}
+
+	return true;
+}
+
+IMPLEMENT_SIMPLE_AUTOMATION_TEST(FDestructionResistanceTest, "Destruction.Component.Resistances", EAutomationTestFlags::ApplicationContextMask | EAutomationTestFlags::ProductFilter)
+
+bool FDestructionResistanceTest::RunTest(const FString& Parameters)
+{
+	constexpr float Health = 1000.0f;
+	constexpr float Damage = 100.0f;
+
+	FDestructionComponentTestHelper Helper(5, Health, EDestructionHealthPrecision::Full, false, [](FDestructionDataSet& DataSet, UDestructionComponent& Component)
+	{
+		DataSet.DamageTypeResistances.Add(TAG_DestructionTest_Fire, 0.5f);
+		DataSet.DamageTypeResistances.Add(TAG_DestructionTest_Explosive, -0.5f);
+		DataSet.DamageTypeResistances.Add(TAG_DestructionTest_Ballistic, 2.0f);
+	});
+
+	if (!TestNotNull(TEXT("Destruction actor spawned"), Helper.DestructionActor))
+	{
+		return false;
+	}
+
+	Helper.Component->ApplyTypedDamageToHitResult(Helper.MakeHitResult(0), Damage, TAG_DestructionTest_Fire);
+	Helper.Component->ApplyTypedDamageToHitResult(Helper.MakeHitResult(1), Damage, TAG_DestructionTest_Napalm);
+	Helper.Component->ApplyTypedDamageToHitResult(Helper.MakeHitResult(2), Damage, TAG_DestructionTest_Explosive);
+	Helper.Component->ApplyTypedDamageToHitResult(Helper.MakeHitResult(3), Damage, TAG_DestructionTest_Ballistic);
+	Helper.Component->ApplyTypedDamageToHitResult(Helper.MakeHitResult(4), Damage, TAG_DestructionTest_Acid);
+
+	TestEqual(TEXT("Resisted damage"), Helper.GetHealth(0), Health - 50.0f);
+	TestEqual(TEXT("A child damage type falls back to its parent's resistance"), Helper.GetHealth(1), Health - 50.0f);
+	TestEqual(TEXT("A negative resistance increases the damage"), Helper.GetHealth(2), Health - 150.0f);
+	TestEqual(TEXT("A resistance above 1 is clamped to full immunity, not healing"), Helper.GetHealth(3), Health);
+	TestEqual(TEXT("A damage type without a resistance takes full damage"), Helper.GetHealth(4), Health - Damage);
+
+	return true;
+}
+
+IMPLEMENT_SIMPLE_AUTOMATION_TEST(FDestructionDamageOverTimeTest, "Destruction.Component.DamageOverTime", EAutomationTestFlags::ApplicationContextMask | EAutomationTestFlags::ProductFilter)
+
+bool FDestructionDamageOverTimeTest::RunTest(const FString& Parameters)
+{
+	// With the default minimum update fraction, pending damage is applied once it reaches 10
+	constexpr float Health = 1000.0f;
+
+	FDestructionComponentTestHelper Helper(3, Health, EDestructionHealthPrecision::Full);
+
+	if (!TestNotNull(TEXT("Destruction actor spawned"), Helper.DestructionActor))
+	{
+		return false;
+	}
+
+	// Refreshing an effect of the same type replaces its rate and duration, and keeps the damage it has accumulated
+	Helper.Component->ApplyDamageOverTimeToHitResult(Helper.MakeHitResult(0), 10.0f, 2.0f, TAG_DestructionTest_Fire);
+	Helper.AdvanceBatch(0.5f);
+
+	TestEqual(TEXT("Damage below the update threshold is held back"), Helper.GetHealth(0), Health);
+
+	Helper.Component->ApplyDamageOverTimeToHitResult(Helper.MakeHitResult(0), 20.0f, 1.0f, TAG_DestructionTest_Fire);
+	TestEqual(TEXT("Refreshing doesn't add a second effect"), Helper.GetNumDamageOverTimeEffects(), 1);
+
+	Helper.AdvanceBatch(0.5f);
+	TestEqual(TEXT("Refreshed effect applies the held back and the new damage"), Helper.GetHealth(0), Health - 15.0f);
+
+	// Only half a second is left on the refreshed effect
+	Helper.AdvanceBatch(0.6f);
+	TestEqual(TEXT("Refreshed effect runs out after its new duration"), Helper.GetHealth(0), Health - 25.0f);
+	TestFalse(TEXT("Expired effect is removed"), Helper.HasDamageOverTimeEffect(0, TAG_DestructionTest_Fire));
+
+	// The remainder below the threshold is applied when the effect runs out
+	Helper.Component->ApplyDamageOverTimeToHitResult(Helper.MakeHitResult(1), 4.0f, 1.0f, TAG_DestructionTest_Fire);
+	Helper.AdvanceBatch(0.5f);
+	TestEqual(TEXT("Remainder is held back while the effect runs"), Helper.GetHealth(1), Health);
+
+	Helper.AdvanceBatch(1.0f);
+	TestEqual(TEXT("Remainder is applied on expiry"), Helper.GetHealth(1), Health - 4.0f);
+	TestFalse(TEXT("Effect is removed on expiry"), Helper.HasDamageOverTimeEffect(1, TAG_DestructionTest_Fire));
+
+	// Destroying an instance drops its effects on the next batch tick, without applying them any further
+	Helper.Component->ApplyDamageOverTimeToHitResult(Helper.MakeHitResult(2), 10.0f, 10.0f, TAG_DestructionTest_Fire);
+	Helper.Component->ApplyDamageOverTimeToHitResult(Helper.MakeHitResult(2), 10.0f, 10.0f, TAG_DestructionTest_Acid);
+	TestEqual(TEXT("Different damage types stack"), Helper.GetNumDamageOverTimeEffects(), 2);
+
+	Helper.Component->ApplyDamageToHitResult(Helper.MakeHitResult(2), Health);
+	TestTrue(TEXT("Instance is destroyed"), Helper.IsDestroyed(2));
+
+	Helper.AdvanceBatch(0.1f);
+	TestEqual(TEXT("Effects on a destroyed instance are removed"), Helper.GetNumDamageOverTimeEffects(), 0);
+
+	return true;
+}
+
+IMPLEMENT_SIMPLE_AUTOMATION_TEST(FDestructionEventLogRoundTripTest, "Destruction.Component.EventLogRoundTrip", EAutomationTestFlags::ApplicationContextMask | EAutomationTestFlags::ProductFilter)
+
+bool FDestructionEventLogRoundTripTest::RunTest(const FString& Parameters)
+{
+	constexpr int32 NumInstances = 4;
+	constexpr int32 NumSteps = 60;
+	constexpr float StepTime = 0.05f;
+	constexpr float Health = 100.0f;
+
+	struct FCapturedState
+	{
+		uint32 Tick;
+		TArray<uint8> Health;
+		TBitArray<> DestroyedInstances;
+	};
+
+	auto Setup = [](FDestructionDataSet& DataSet, UDestructionComponent& Component)
+	{
+		DataSet.RespawnTime = 1.0f;
+		Component.EventLogSnapshotInterval = 30;
+	};
+
+	const FString ExportFilename = FPaths::Combine(FPaths::AutomationTransientDir(), TEXT("DestructionEventLogRoundTrip.devl"));
+
+	const EDestructionHealthPrecision Precisions[] = { EDestructionHealthPrecision::Full, EDestructionHealthPrecision::Quantized16, EDestructionHealthPrecision::Quantized8 };
+
+	for (const EDestructionHealthPrecision HealthPrecision : Precisions)
+	{
+		const FString PrecisionName = UEnum::GetValueAsString(HealthPrecision);
+
+		FDestructionComponentTestHelper Helper(NumInstances, Health, HealthPrecision, true, Setup);
+
+		if (!TestNotNull(TEXT("Destruction actor spawned"), Helper.DestructionActor))
+		{
+			return false;
+		}
+
+		TestTrue(TEXT("Export started"), Helper.Component->StartEventLogExport(ExportFilename));
+
+		// Damage, repairs, damage over time, destroys and respawns, capturing the live state after every step.
+		// Instance 1 is destroyed at step 10 and respawns at step 30, instance 2 at step 35 and 55
+		TArray<FCapturedState> Captures;
+
+		for (int32 Step = 0; Step < NumSteps; Step++)
+		{
+			Helper.AdvanceBatch(StepTime);
+
+			Helper.Component->ApplyDamageToHitResult(Helper.MakeHitResult(0), 1.3f);
+
+			if (Step % 4 == 0)
+			{
+				Helper.Component->RepairHitResult(Helper.MakeHitResult(0), 2.9f);
+			}
+
+			if (Step == 5)
+			{
+				Helper.Component->ApplyDamageOverTimeToHitResult(Helper.MakeHitResult(3), 10.0f, 2.0f, TAG_DestructionTest_Fire);
+			}
+
+			if (Step == 10)
+			{
+				Helper.Component->ApplyDamageToHitResult(Helper.MakeHitResult(1), 150.0f);
+			}
+
+			if (Step == 35)
+			{
+				Helper.Component->ApplyDamageToHitResult(Helper.MakeHitResult(2), 200.0f);
+			}
+
+			Captures.Add({ Helper.GetEventTick(), Helper.GetHealthData(), Helper.GetDestroyedInstances() });
+		}
+
+		Helper.Component->StopEventLogExport();
+
+		TestTrue(FString::Printf(TEXT("%s: instance 1 destroyed"), *PrecisionName), Captures[20].DestroyedInstances[1]);
+		TestFalse(FString::Printf(TEXT("%s: instance 1 respawned"), *PrecisionName), Captures.Last().DestroyedInstances[1]);
+		TestTrue(FString::Printf(TEXT("%s: instance 2 destroyed"), *PrecisionName), Captures[40].DestroyedInstances[2]);
+
+		// Every captured tick must reconstruct to exactly the live state, whichever snapshot it starts from
+		for (const FCapturedState& Capture : Captures)
+		{
+			FDestructionStateSnapshot State;
+
+			if (TestTrue(FString::Printf(TEXT("%s: reconstructed tick %u"), *PrecisionName, Capture.Tick), Helper.Component->ReconstructStateAtTick(Capture.Tick, State)))
+			{
+				TestTrue(FString::Printf(TEXT("%s: tick %u health"), *PrecisionName, Capture.Tick), State.Health == Capture.Health);
+				TestTrue(FString::Printf(TEXT("%s: tick %u destroyed instances"), *PrecisionName, Capture.Tick), State.DestroyedInstances == Capture.DestroyedInstances);
+			}
+		}
+
+		TestTrue(FString::Printf(TEXT("%s: reconstructing leaves the live state alone"), *PrecisionName), Helper.GetHealthData() == Captures.Last().Health);
+
+		// An instance that doesn't record only has the initial snapshot to replay the loaded log from
+		{
+			FDestructionComponentTestHelper Viewer(NumInstances, Health, HealthPrecision, false, Setup);
+
+			if (TestTrue(FString::Printf(TEXT("%s: exported log loaded"), *PrecisionName), Viewer.Component->LoadEventLog(ExportFilename)))
+			{
+				for (const int32 CaptureIndex : { 0, 15, 40, NumSteps - 1 })
+				{
+					FDestructionStateSnapshot State;
+
+					if (TestTrue(FString::Printf(TEXT("%s: loaded log reconstructed step %d"), *PrecisionName, CaptureIndex), Viewer.Component->ReconstructStateAtTick(Captures[CaptureIndex].Tick, State)))
+					{
+						TestTrue(FString::Printf(TEXT("%s: loaded log step %d health"), *PrecisionName, CaptureIndex), State.Health == Captures[CaptureIndex].Health);
+					}
+				}
+			}
+		}
+
+		// Roll back to a tick where instance 2 is destroyed and waiting to respawn
+		const FCapturedState& RollbackCapture = Captures[40];
+
+		if (!TestTrue(FString::Printf(TEXT("%s: rolled back"), *PrecisionName), Helper.Component->RollbackToTick(RollbackCapture.Tick)))
+		{
+			continue;
+		}
+
+		TestTrue(FString::Printf(TEXT("%s: rolled back health"), *PrecisionName), Helper.GetHealthData() == RollbackCapture.Health);
+		TestTrue(FString::Printf(TEXT("%s: rolled back destroyed instances"), *PrecisionName), Helper.GetDestroyedInstances() == RollbackCapture.DestroyedInstances);
+		TestTrue(FString::Printf(TEXT("%s: later events are dropped"), *PrecisionName), Helper.GetEvents().Num() > 0 && Helper.GetEvents().Last().Tick <= RollbackCapture.Tick);
+		TestEqual(FString::Printf(TEXT("%s: pending respawn is rebuilt"), *PrecisionName), Helper.GetNumScheduledRespawns(), 1);
+
+		// The rebuilt respawn only waits for the rest of its time, about 0.75 seconds
+		for (int32 Step = 0; Step < 20; Step++)
+		{
+			Helper.AdvanceBatch(StepTime);
+		}
+
+		TestFalse(FString::Printf(TEXT("%s: instance 2 respawns after the rollback"), *PrecisionName), Helper.IsDestroyed(2));
+		TestEqual(FString::Printf(TEXT("%s: respawned at full health"), *PrecisionName), Helper.GetHealth(2), Health);
+		TestTrue(FString::Printf(TEXT("%s: recording continues after the target tick"), *PrecisionName), Helper.GetEvents().Last().Type == EDestructionEventType::Respawn && Helper.GetEvents().Last().Tick > RollbackCapture.Tick);
+	}
+
+	IFileManager::Get().Delete(*ExportFilename);
+
+	return true;
+}
+
+IMPLEMENT_SIMPLE_AUTOMATION_TEST(FDestructionRespawnWheelTest, "Destruction.Component.RespawnWheel", EAutomationTestFlags::ApplicationContextMask | EAutomationTestFlags::ProductFilter)
+
+bool FDestructionRespawnWheelTest::RunTest(const FString& Parameters)
+{
+	// A small wheel, so full turns are cheap to step through. One turn is 4 seconds
+	constexpr int32 NumSlots = 8;
+	constexpr float SlotDuration = 0.5f;
+
+	{
+		FDestructionRespawnWheel Wheel;
+		Wheel.Init(NumSlots, SlotDuration);
+
+		FMemMark Mark(FMemStack::Get());
+		TArray<int32, TMemStackAllocator<>> DueInstances;
+
+		// 20 slots, which lands on a slot that comes by twice before the entry is due
+		Wheel.Schedule(1, 10.0f);
+		// A rebuilt delay that already ran out is due on the next slot, like the shortest delay
+		Wheel.Schedule(2, -3.0f);
+		Wheel.Schedule(3, SlotDuration);
+
+		TestEqual(TEXT("Scheduled respawns"), Wheel.Num(), 3);
+
+		Wheel.Advance(SlotDuration, DueInstances);
+		TestEqual(TEXT("Negative and one slot delays are due after one slot"), DueInstances.Num(), 2);
+		TestTrue(TEXT("Negative delay is due"), DueInstances.Contains(2));
+		TestTrue(TEXT("One slot delay is due"), DueInstances.Contains(3));
+
+		DueInstances.Reset();
+
+		for (int32 Slot = 1; Slot < 19; Slot++)
+		{
+			Wheel.Advance(SlotDuration, DueInstances);
+		}
+
+		TestEqual(TEXT("Not due while its slot comes by on earlier turns"), DueInstances.Num(), 0);
+
+		Wheel.Advance(SlotDuration, DueInstances);
+		TestTrue(TEXT("Due after more than two full turns"), DueInstances.Num() == 1 && DueInstances[0] == 1);
+		TestEqual(TEXT("Wheel is empty"), Wheel.Num(), 0);
+
+		// One large step passes several slots at once
+		DueInstances.Reset();
+		Wheel.Schedule(4, 1.2f);
+		Wheel.Advance(2.0f, DueInstances);
+		TestTrue(TEXT("Due within a step spanning several slots"), DueInstances.Num() == 1 && DueInstances[0] == 4);
+	}
+
+	// The component's wheel, with a respawn time longer than one turn of its slots at the default batch rate
+	{
+		constexpr float RespawnTime = 30.0f;
+		constexpr float BatchStep = 0.1f;
+
+		FDestructionComponentTestHelper Helper(1, 100.0f, EDestructionHealthPrecision::Full, false, [](FDestructionDataSet& DataSet, UDestructionComponent& Component)
+		{
+			DataSet.RespawnTime = RespawnTime;
+		});
+
+		if (!TestNotNull(TEXT("Destruction actor spawned"), Helper.DestructionActor))
+		{
+			return false;
+		}
+
+		Helper.Component->ApplyDamageToHitResult(Helper.MakeHitResult(0), 100.0f);
+
+		for (int32 Step = 0; Step < FMath::RoundToInt(RespawnTime / BatchStep) - 5; Step++)
+		{
+			Helper.AdvanceBatch(BatchStep);
+		}
+
+		TestTrue(TEXT("Still destroyed after more than a full turn"), Helper.IsDestroyed(0));
+
+		for (int32 Step = 0; Step < 10; Step++)
+		{
+			Helper.AdvanceBatch(BatchStep);
+		}
+
+		TestFalse(TEXT("Respawned after its respawn time"), Helper.IsDestroyed(0));
+	}
+
+	// A rollback to a tick where the respawn was overdue but not ticked yet rebuilds it with a negative delay
+	{
+		FDestructionComponentTestHelper Helper(1, 100.0f, EDestructionHealthPrecision::Full, true, [](FDestructionDataSet& DataSet, UDestructionComponent& Component)
+		{
+			DataSet.RespawnTime = 1.0f;
+		});
+
+		if (!TestNotNull(TEXT("Destruction actor spawned"), Helper.DestructionActor))
+		{
+			return false;
+		}
+
+		Helper.AdvanceBatch(0.1f);
+		Helper.Component->ApplyDamageToHitResult(Helper.MakeHitResult(0), 100.0f);
+
+		// Time passes without the batch being advanced
+		Helper.World->TimeSeconds += 2.0;
+
+		TestTrue(TEXT("Rolled back"), Helper.Component->RollbackToTick(Helper.GetEventTick()));
+		TestTrue(TEXT("Still destroyed after the rollback"), Helper.IsDestroyed(0));
+		TestEqual(TEXT("Overdue respawn is rebuilt"), Helper.GetNumScheduledRespawns(), 1);
+
+		Helper.AdvanceBatch(0.1f);
+		TestFalse(TEXT("Overdue respawn fires on the next batch tick"), Helper.IsDestroyed(0));
+	}
+
+	return true;
+}
+
+IMPLEMENT_SIMPLE_AUTOMATION_TEST(FDestructionRepairTest, "Destruction.Component.Repairs", EAutomationTestFlags::ApplicationContextMask | EAutomationTestFlags::ProductFilter)
+
+bool FDestructionRepairTest::RunTest(const FString& Parameters)
+{
+	constexpr float Health = 100.0f;
+
+	FDestructionComponentTestHelper Helper(3, Health, EDestructionHealthPrecision::Full);
+
+	if (!TestNotNull(TEXT("Destruction actor spawned"), Helper.DestructionActor))
+	{
+		return false;
+	}
+
+	// Instant repairs are clamped to the max health
+	Helper.Component->ApplyDamageToHitResult(Helper.MakeHitResult(0), 30.0f);
+	Helper.Component->RepairHitResult(Helper.MakeHitResult(0), 50.0f);
+	TestEqual(TEXT("Repair is clamped to the max health"), Helper.GetHealth(0), Health);
+
+	// Repairing over time finishes once the instance is back at full health
+	Helper.Component->ApplyDamageToHitResult(Helper.MakeHitResult(1), 30.0f);
+	Helper.Component->StartRepairingHitResult(Helper.MakeHitResult(1), 10.0f);
+	Helper.Component->StartRepairingHitResult(Helper.MakeHitResult(1), 20.0f);
+	TestEqual(TEXT("Starting again only changes the rate"), Helper.GetNumActiveRepairs(), 1);
+
+	Helper.AdvanceBatch(1.0f);
+	TestEqual(TEXT("Repaired at the new rate"), Helper.GetHealth(1), Health - 10.0f);
+	TestEqual(TEXT("Still repairing below full health"), Helper.GetNumActiveRepairs(), 1);
+
+	Helper.AdvanceBatch(1.0f);
+	TestEqual(TEXT("Repair over time is clamped to the max health"), Helper.GetHealth(1), Health);
+	TestEqual(TEXT("Finished repair is removed"), Helper.GetNumActiveRepairs(), 0);
+
+	// A repair ends when its instance is destroyed, and destroyed instances can't be repaired
+	Helper.Component->ApplyDamageToHitResult(Helper.MakeHitResult(2), 30.0f);
+	Helper.Component->StartRepairingHitResult(Helper.MakeHitResult(2), 10.0f);
+	Helper.Component->ApplyDamageToHitResult(Helper.MakeHitResult(2), Health);
+
+	Helper.AdvanceBatch(1.0f);
+	TestEqual(TEXT("Repair of a destroyed instance is removed"), Helper.GetNumActiveRepairs(), 0);
+	TestTrue(TEXT("Destroyed instance stays destroyed"), Helper.IsDestroyed(2));
+
+	Helper.Component->RepairHitResult(Helper.MakeHitResult(2), 50.0f);
+	TestTrue(TEXT("Instant repair doesn't bring back a destroyed instance"), Helper.IsDestroyed(2));
+
+	return true;
+}
+
+#endif //WITH_DEV_AUTOMATION_TESTS
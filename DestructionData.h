@@ -24,6 +24,15 @@ struct GUNZILLATEST_API FDestructionDataSet
 	// The color to use per each health state
 	UPROPERTY(EditDefaultsOnly, BlueprintReadOnly)
 	UCurveLinearColor* HealthStateColorCurve;
+
+	// Fraction of incoming damage ignored per damage type, e.g. 0.75 for Damage.Ballistic on concrete. Negative values make the piece weak against that type
+	// Damage types without an entry fall back to their closest parent tag, and take full damage if none is found
+	UPROPERTY(EditDefaultsOnly, BlueprintReadOnly)
+	TMap<FGameplayTag, float> DamageTypeResistances;
+
+	// Seconds until a destroyed piece respawns at full health. 0 keeps destroyed pieces gone for good
+	UPROPERTY(EditDefaultsOnly, BlueprintReadOnly)
+	float RespawnTime = 0.0f;
 };
 
 UCLASS(BlueprintType, Meta = (DisplayName = "Destruction Data", ShortTooltip = "Data asset containing all relevant data for initializing the destruction assets."))
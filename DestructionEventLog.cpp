@@ -0,0 +1,220 @@
+// Copyright 2024, Talos Interactive, LLC. All Rights Reserved.
+
+#include "DestructionEventLog.h"
+#include "HAL/FileManager.h"
+#include "Serialization/MemoryWriter.h"
+
+namespace DestructionEventLog
+{
+	static constexpr uint32 FileMagic = 0x4C564544; // "DEVL"
+	static constexpr uint32 FileVersion = 1;
+
+	// The size of one event on disk, FDestructionEvent without its padding
+	static constexpr int64 SerializedEventSize = 15;
+
+	// How many events are streamed out before the export is flushed to disk
+	static constexpr int32 EventsPerFlush = 64;
+}
+
+FArchive& operator<<(FArchive& Ar, FDestructionEvent& Event)
+{
+	uint8 Type = (uint8)Event.Type;
+
+	Ar << Event.Tick;
+	Ar << Event.GlobalInstanceIndex;
+	Ar << Event.Damage;
+	Ar << Event.DataSetId;
+	Ar << Type;
+
+	Event.Type = (EDestructionEventType)Type;
+
+	return Ar;
+}
+
+FDestructionEventLog::~FDestructionEventLog()
+{
+	StopExport();
+}
+
+void FDestructionEventLog::Record(const FDestructionEvent& Event)
+{
+	Events.Add(Event);
+
+	if (ExportWriter.IsValid())
+	{
+		FMemoryWriter PendingWriter(PendingExport);
+		PendingWriter.Seek(PendingExport.Num());
+		PendingWriter << Events.Last();
+
+		if (++NumUnflushedEvents >= DestructionEventLog::EventsPerFlush)
+		{
+			FlushExport();
+		}
+	}
+}
+
+void FDestructionEventLog::AddSnapshot(FDestructionStateSnapshot&& Snapshot)
+{
+	Snapshots.Add(MoveTemp(Snapshot));
+}
+
+const FDestructionStateSnapshot* FDestructionEventLog::FindSnapshot(uint32 Tick) const
+{
+	for (int32 i = Snapshots.Num() - 1; i >= 0; i--)
+	{
+		if (Snapshots[i].Tick <= Tick)
+		{
+			return &Snapshots[i];
+		}
+	}
+
+	return nullptr;
+}
+
+void FDestructionEventLog::Truncate(uint32 Tick)
+{
+	int32 NumEvents = Events.Num();
+
+	// Events are recorded in tick order
+	while (NumEvents > 0 && Events[NumEvents - 1].Tick > Tick)
+	{
+		NumEvents--;
+	}
+
+	if (NumEvents == Events.Num())
+	{
+		return;
+	}
+
+	Events.SetNum(NumEvents, false);
+
+	while (Snapshots.Num() > 1 && Snapshots.Last().Tick > Tick)
+	{
+		Snapshots.Pop(false);
+	}
+
+	// The dropped events were already streamed out, so write the file again from what is left
+	if (ExportWriter.IsValid())
+	{
+		const FString Filename = ExportFilename;
+		StartExport(Filename, ExportNumInstances);
+	}
+}
+
+bool FDestructionEventLog::StartExport(const FString& Filename, int32 NumInstances)
+{
+	StopExport();
+
+	ExportFilename = Filename;
+	ExportNumInstances = NumInstances;
+
+	ExportWriter = TUniquePtr<FArchive>(IFileManager::Get().CreateFileWriter(*Filename));
+
+	if (!ExportWriter.IsValid())
+	{
+		return false;
+	}
+
+	uint32 Magic = DestructionEventLog::FileMagic;
+	uint32 Version = DestructionEventLog::FileVersion;
+
+	FMemoryWriter PendingWriter(PendingExport);
+
+	PendingWriter << Magic;
+	PendingWriter << Version;
+	PendingWriter << NumInstances;
+
+	for (FDestructionEvent& Event : Events)
+	{
+		PendingWriter << Event;
+	}
+
+	FlushExport();
+
+	return true;
+}
+
+void FDestructionEventLog::FlushExport()
+{
+	if (!ExportWriter.IsValid() || PendingExport.Num() == 0)
+	{
+		return;
+	}
+
+	// The writer is only touched by these tasks until StopExport waits for the last one
+	auto WriteBlock = [Writer = ExportWriter.Get(), Block = MoveTemp(PendingExport)]() mutable
+	{
+		Writer->Serialize(Block.GetData(), Block.Num());
+		Writer->Flush();
+	};
+
+	ExportTask = ExportTask.IsValid()
+		? UE::Tasks::Launch(TEXT("DestructionEventLogExport"), MoveTemp(WriteBlock), UE::Tasks::Prerequisites(ExportTask))
+		: UE::Tasks::Launch(TEXT("DestructionEventLogExport"), MoveTemp(WriteBlock));
+
+	PendingExport.Reset(DestructionEventLog::EventsPerFlush * DestructionEventLog::SerializedEventSize);
+	NumUnflushedEvents = 0;
+}
+
+void FDestructionEventLog::StopExport()
+{
+	if (ExportWriter.IsValid())
+	{
+		FlushExport();
+
+		if (ExportTask.IsValid())
+		{
+			ExportTask.Wait();
+			ExportTask = UE::Tasks::FTask();
+		}
+
+		ExportWriter->Close();
+		ExportWriter.Reset();
+		NumUnflushedEvents = 0;
+	}
+}
+
+bool FDestructionEventLog::Load(const FString& Filename, int32 NumInstances)
+{
+	TUniquePtr<FArchive> Reader(IFileManager::Get().CreateFileReader(*Filename));
+
+	if (!Reader.IsValid())
+	{
+		return false;
+	}
+
+	uint32 Magic = 0;
+	uint32 Version = 0;
+	int32 FileNumInstances = INDEX_NONE;
+
+	*Reader << Magic;
+	*Reader << Version;
+	*Reader << FileNumInstances;
+
+	// The instance handles are only meaningful against the same level manifest
+	if (Magic != DestructionEventLog::FileMagic || Version != DestructionEventLog::FileVersion || FileNumInstances != NumInstances)
+	{
+		return false;
+	}
+
+	// The export streams this session's events, which are about to be replaced
+	StopExport();
+
+	Events.Reset();
+
+	// Stop at a truncated last event instead of failing the whole file
+	while (!Reader->IsError() && Reader->TotalSize() - Reader->Tell() >= DestructionEventLog::SerializedEventSize)
+	{
+		FDestructionEvent Event;
+		*Reader << Event;
+		Events.Add(Event);
+	}
+
+	// Later snapshots belong to the session that is being replaced
+	if (Snapshots.Num() > 1)
+	{
+		Snapshots.SetNum(1);
+	}
+
+	return !Reader->IsError();
+}
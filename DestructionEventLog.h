@@ -0,0 +1,123 @@
+// Copyright 2024, Talos Interactive, LLC. All Rights Reserved.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "Tasks/Task.h"
+
+// An append-only log of everything that changed the destruction state during a match
+// It is recorded on the server, can be streamed to disk as it grows and is replayed on top of state snapshots
+// to reconstruct the destruction state at any tick, e.g. for replays, demos or investigating desync reports.
+
+/** The kind of state change a destruction event records */
+enum class EDestructionEventType : uint8
+{
+	Damage,
+	Destroy,
+	Repair,
+	Respawn
+};
+
+/** One recorded state change, packed to 16 bytes */
+struct FDestructionEvent
+{
+	/** Event log ticks (1/60th of a second of world time) since the destruction component began play */
+	uint32 Tick = 0;
+
+	/** The instance handle, which is the index into the level script manifest */
+	int32 GlobalInstanceIndex = INDEX_NONE;
+
+	/** The damage that was applied after resistances, or the amount a repair was requested with */
+	float Damage = 0.0f;
+
+	/** Net index of the instance's data set tag, used to catch manifest mismatches on replay */
+	uint16 DataSetId = 0;
+
+	EDestructionEventType Type = EDestructionEventType::Damage;
+
+	uint8 Padding = 0;
+
+	friend FArchive& operator<<(FArchive& Ar, FDestructionEvent& Event);
+};
+
+static_assert(sizeof(FDestructionEvent) == 16, "FDestructionEvent is expected to stay 16 bytes");
+
+/** A copy of the per-instance state at a given tick, the starting point for replaying events */
+struct FDestructionStateSnapshot
+{
+	uint32 Tick = 0;
+
+	/** Number of events that had been recorded when the snapshot was taken */
+	int32 EventIndex = 0;
+
+	TArray<uint8> Health;
+
+	TBitArray<> DestroyedInstances;
+};
+
+class GUNZILLATEST_API FDestructionEventLog
+{
+public:
+
+	~FDestructionEventLog();
+
+	/** Append an event, and queue it for the export if one is running. Every few events the queued ones are handed to the background writer */
+	void Record(const FDestructionEvent& Event);
+
+	/** Snapshots are expected to be added in tick order */
+	void AddSnapshot(FDestructionStateSnapshot&& Snapshot);
+
+	/** Get the latest snapshot taken at or before the given tick */
+	const FDestructionStateSnapshot* FindSnapshot(uint32 Tick) const;
+
+	uint32 GetLastSnapshotTick() const { return Snapshots.Num() > 0 ? Snapshots.Last().Tick : 0; };
+
+	const TArray<FDestructionEvent>& GetEvents() const { return Events; };
+
+	/** Make room for the given number of events, so recording doesn't grow the array until the log outgrows it */
+	void Reserve(int32 NumEvents) { Events.Reserve(NumEvents); };
+
+	/** Drop all events and snapshots after the given tick. A running export is rewritten to match */
+	void Truncate(uint32 Tick);
+
+	/** Start streaming the log to a file. Events recorded so far are written out first */
+	bool StartExport(const FString& Filename, int32 NumInstances);
+
+	void StopExport();
+
+	/**
+	*	Hand everything queued for the export to the background writer, which writes it and flushes it to disk so a crash doesn't lose the tail of the log.
+	*	Doesn't block, the game thread never waits on the file unless the export is stopped
+	*/
+	void FlushExport();
+
+	bool IsExporting() const { return ExportWriter.IsValid(); };
+
+	/**
+	*	Replace the recorded events with the ones from an exported file. Only the initial snapshot is kept.
+	*	A truncated last event, e.g. from a server that crashed while writing, is dropped
+	*/
+	bool Load(const FString& Filename, int32 NumInstances);
+
+private:
+
+	TArray<FDestructionEvent> Events;
+
+	TArray<FDestructionStateSnapshot> Snapshots;
+
+	TUniquePtr<FArchive> ExportWriter;
+
+	/** Where the running export goes, and the manifest size it was started with */
+	FString ExportFilename;
+
+	int32 ExportNumInstances = 0;
+
+	/** Events queued for the export since it was last flushed */
+	int32 NumUnflushedEvents = 0;
+
+	/** The serialized events queued for the export, written out as one block */
+	TArray<uint8> PendingExport;
+
+	/** The last write handed to the background, each write waits for the previous one so the file stays in order */
+	UE::Tasks::FTask ExportTask;
+};
@@ -19,10 +19,16 @@ public:
 #endif //WITH_EDITOR
 
 	// Get the tags of all destructible instances
-	TArray<FGameplayTag> GetDestuctibleTags() { return DestructibleTags; };
+	const TArray<FGameplayTag>& GetDestuctibleTags() const { return DestructibleTags; };
 
 	// Get the transform of all destructible instances
-	TArray<FTransform> GetDestructibleTransforms() { return DestructibleTransforms; };
+	const TArray<FTransform>& GetDestructibleTransforms() const { return DestructibleTransforms; };
+
+	// Get the tag of a single destructible instance by its manifest index
+	const FGameplayTag& GetDestructibleTag(int32 Index) const { return DestructibleTags[Index]; };
+
+	// Get the transform of a single destructible instance by its manifest index
+	const FTransform& GetDestructibleTransform(int32 Index) const { return DestructibleTransforms[Index]; };
 
 private:
 
@@ -36,4 +42,8 @@ private:
 	UPROPERTY()
 	TArray<FTransform> DestructibleTransforms;
 
+#if WITH_DEV_AUTOMATION_TESTS
+	friend struct FDestructionComponentTestHelper;
+#endif //WITH_DEV_AUTOMATION_TESTS
+
 };